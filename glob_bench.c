@@ -0,0 +1,141 @@
+/*glob_bench.c
+ *
+ *Benchmark for the mysh glob engine. Fills a scratch directory with files
+ *and times mysh_glob against glob(3) expanding the same patterns over it.
+ *
+ *Build and run (From the directory holding mysh.c):
+ * gcc -std=c99 -O2 -o glob_bench glob_bench.c && ./glob_bench [files] [dir]
+ */
+
+#define main mysh_main
+#include "mysh.c"
+#undef main
+
+#include <glob.h>
+#include <time.h>
+
+#define BENCH_FILES 500000
+#define BENCH_ROUNDS 3
+
+/*bench_now
+ *
+ * @return Seconds on the monotonic clock
+ */
+static double bench_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}//end bench_now
+
+/*bench_fill
+ *
+ * Creates files f0.log, f1.txt, f2.log, ... in dir unless they already exist.
+ *
+ * @return 0 Upon success
+ * @return 1 If the directory could not be filled
+ */
+static int bench_fill(const char * dir, int files)
+{
+    char path[PATH_MAX];
+    if(mkdir(dir, 0700) < 0 && errno != EEXIST)
+    {
+        perror(dir);
+        return 1;
+    }
+    for(int i = 0; i < files; i++)
+    {
+        snprintf(path, sizeof(path), "%s/f%d.%s", dir, i, i % 2 ? "txt" : "log");
+        int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+        if(fd < 0)
+        {
+            perror(path);
+            return 1;
+        }
+        close(fd);
+    }
+    return 0;
+}//end bench_fill
+
+/*bench_libc
+ *
+ * Expands count patterns with glob(3), appending to one result.
+ *
+ * @return Seconds taken
+ */
+static double bench_libc(char ** patterns, int count, size_t * matches)
+{
+    glob_t libc;
+    double start = bench_now();
+    for(int i = 0; i < count; i++)
+    {
+        glob(patterns[i], i ? GLOB_APPEND : 0, NULL, &libc);
+    }
+    double taken = bench_now() - start;
+    *matches = libc.gl_pathc;
+    globfree(&libc);
+    return taken;
+}//end bench_libc
+
+/*bench_mysh
+ *
+ * Expands count patterns with one mysh_glob call, so directories they share
+ * are read once through the per-line listing cache.
+ *
+ * @return Seconds taken
+ */
+static double bench_mysh(char ** patterns, int count, size_t * matches)
+{
+    char * words[3];
+    Glob mysh = {0};
+    memcpy(words, patterns, sizeof(char *) * count);
+    words[count] = NULL;
+    double start = bench_now();
+    mysh_glob(&mysh, words);
+    double taken = bench_now() - start;
+    *matches = mysh.count;
+    mysh_glob_free(&mysh);
+    return taken;
+}//end bench_mysh
+
+/*main
+ *
+ * Times each engine on "*.log" and on "f1*.txt" by themselves, which shows
+ * the raw directory scan, and then on both patterns together. glob(3) reads
+ * the directory once per pattern while mysh_glob reads it once per line, so
+ * any gap in the last row comes from the listing cache.
+ *
+ * @params argv [files] [dir]; defaults to 500000 files in glob_bench.d
+ * @return 0 Upon success
+ */
+int main(int argc, char * argv[])
+{
+    int files = argc > 1 ? atoi(argv[1]) : BENCH_FILES;
+    const char * dir = argc > 2 ? argv[2] : "glob_bench.d";
+    char * patterns[] = {"*.log", "f1*.txt"};
+    const char * names[] = {"*.log", "f1*.txt", "*.log f1*.txt"};
+    int starts[] = {0, 1, 0};
+    int counts[] = {1, 1, 2};
+    if(files <= 0 || bench_fill(dir, files) || chdir(dir) < 0)
+    {
+        fprintf(stderr, "usage: glob_bench [files] [dir]\n");
+        return 1;
+    }
+
+    for(int round = 0; round < BENCH_ROUNDS; round++)
+    {
+        for(int run = 0; run < 3; run++)
+        {
+            size_t libcMatches;
+            size_t myshMatches;
+            double libcTime = bench_libc(patterns + starts[run], counts[run],
+                    &libcMatches);
+            double myshTime = bench_mysh(patterns + starts[run], counts[run],
+                    &myshMatches);
+            printf("%-14s glob(3): %zu matches in %.3fs   "
+                    "mysh_glob: %zu matches in %.3fs\n", names[run],
+                    libcMatches, libcTime, myshMatches, myshTime);
+        }
+    }
+    return 0;
+}//end main
@@ -2,9 +2,9 @@
  *
  *Author: Alexander R. Cavaliere <arc6393@rit.edu>
  *
- *My shell implementation; the shell can handle 5 internal commands
- *(Bang, Help, History, Quit, and Verbose!) and UNIX commands via fork, exec,
- * and wait.
+ *My shell implementation; the shell can handle 7 internal commands
+ *(Bang, Export, Help, History, Quit, Unset, and Verbose!), shell variables,
+ * and UNIX commands via fork, exec, and wait.
  *
  *Version:
  * $Id: mysh.c,v 1.8 2014/12/12 03:55:02 arc6393 Exp $
@@ -17,337 +17,2758 @@
 #include <string.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
+#include <sys/uio.h>
+#include <stdarg.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/signalfd.h>
+#include <poll.h>
+#include <signal.h>
+#include <errno.h>
+#include <getopt.h>
 
 
 //GLOBALS
+typedef struct commandProgram Program;
+
 typedef struct historyList
 {
-    char **commandHistory;
-    int commands;
-    int commandHistoryMem;
-} History;
+    char **commandHistory;
+    Program **commandPrograms;  //Compiled form of each entry (NULL if bad)
+    int commands;
+    int commandHistoryMem;
+} History;
+
+typedef struct variableEntry
+{
+    char * pair;          //"NAME=value"; handed to exec as is. A bare
+                          //"NAME" is exported but not set yet
+    size_t nameLength;
+    unsigned int hash;
+    int exported;
+} Variable;
+
+typedef struct variableTable
+{
+    Variable * slots;     //Open addressing, linear probing
+    int capacity;         //Always a power of two
+    int used;             //Live entries plus tombstones
+    int live;
+    char ** envp;         //Cached environment for exec
+    int envpDirty;
+} Variables;
+
+static Variables shellVariables;
+static char variableTombstone;
+#define TOMBSTONE (&variableTombstone)
+#define VARIABLES_MIN 64
+#define MAX_ARGUMENTS 1024
+
+extern char ** environ;
+int mysh_export(int argc, char * argv[]);
+int mysh_unset(int argc, char * argv[]);
+void mysh_forget_paths(void);
+
+typedef struct outputBuffer
+{
+    char * data;            //Allocated on first use
+    size_t used;
+} Output;
+
+typedef struct outputCounters
+{
+    int enabled;            //--output-stats
+    unsigned long calls;    //Writes asked for by the shell
+    unsigned long syscalls; //writev calls actually made
+    unsigned long bytes;
+} OutputStats;
+
+static Output shellOutput[3];       //Indexed by fd; only 1 and 2 are used
+static int outputLast = 1;          //The fd written to most recently
+static OutputStats outputStats;
+
+#define OUTPUT_BUFFER (1 << 22)
+
+/*mysh_output_send
+ *
+ * Writes out whatever is buffered for fd followed by extra (Which may be
+ * empty) with as few writev calls as the kernel allows.
+ */
+static void mysh_output_send(int fd, const char * extra, size_t extraLength)
+{
+    Output * out = &shellOutput[fd];
+    struct iovec pieces[2] = {{out->data, out->used},
+            {(char *)extra, extraLength}};
+    struct iovec * next = pieces;
+    int count = 2;
+    while(count > 0)
+    {
+        if(next->iov_len == 0)
+        {
+            next++;
+            count--;
+            continue;
+        }
+        ssize_t bytes = writev(fd, next, count);
+        if(bytes < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        outputStats.syscalls++;
+        outputStats.bytes += bytes;
+        while(count > 0 && (size_t)bytes >= next->iov_len)
+        {
+            bytes -= next->iov_len;
+            next++;
+            count--;
+        }
+        if(count > 0)
+        {
+            next->iov_base = (char *)next->iov_base + bytes;
+            next->iov_len -= bytes;
+        }
+    }
+    out->used = 0;
+}//end mysh_output_send
+
+/*mysh_flush
+ *
+ * Writes out everything the shell has buffered. Called at each prompt,
+ * before every fork, and before the shell exits, so output stays in order
+ * with the output of child processes.
+ */
+void mysh_flush(void)
+{
+    for(int fd = 1; fd < 3; fd++)
+    {
+        if(shellOutput[fd].used)
+        {
+            mysh_output_send(fd, NULL, 0);
+        }
+    }
+}//end mysh_flush
+
+/*mysh_output_switch
+ *
+ * Gets the buffer for fd ready to take more output. Whatever is pending on
+ * the other fd goes out first so stdout and stderr keep their order.
+ */
+static Output * mysh_output_switch(int fd)
+{
+    if(fd != outputLast)
+    {
+        if(shellOutput[outputLast].used)
+        {
+            mysh_output_send(outputLast, NULL, 0);
+        }
+        outputLast = fd;
+    }
+    if(shellOutput[fd].data == NULL)
+    {
+        shellOutput[fd].data = (char *) malloc(OUTPUT_BUFFER);
+    }
+    outputStats.calls++;
+    return &shellOutput[fd];
+}//end mysh_output_switch
+
+/*mysh_write
+ *
+ * Buffers length bytes of data for fd (1 or 2). Data that does not fit is
+ * written straight away in the same writev as the buffer.
+ */
+void mysh_write(int fd, const char * data, size_t length)
+{
+    Output * out = mysh_output_switch(fd);
+    if(out->used + length > OUTPUT_BUFFER)
+    {
+        mysh_output_send(fd, data, length);
+        return;
+    }
+    memcpy(out->data + out->used, data, length);
+    out->used += length;
+}//end mysh_write
+
+/*mysh_out
+ *
+ * printf into the output buffer for fd (1 or 2).
+ */
+void mysh_out(int fd, const char * format, ...)
+{
+    Output * out = mysh_output_switch(fd);
+    va_list list;
+    va_start(list, format);
+    int length = vsnprintf(out->data + out->used, OUTPUT_BUFFER - out->used,
+            format, list);
+    va_end(list);
+    if(length < 0)
+    {
+        return;
+    }
+    if(out->used + length < OUTPUT_BUFFER)
+    {
+        out->used += length;
+        return;
+    }
+
+    //Did not fit; format it on its own and send it with the buffer
+    char * text = (char *) malloc(length + 1);
+    va_start(list, format);
+    vsnprintf(text, length + 1, format, list);
+    va_end(list);
+    mysh_output_send(fd, text, length);
+    free(text);
+}//end mysh_out
+
+/*mysh_perror
+ *
+ * perror through the output buffer.
+ */
+void mysh_perror(const char * message)
+{
+    mysh_out(2, "%s: %s\n", message, strerror(errno));
+}//end mysh_perror
+
+/*mysh_output_free
+ *
+ * Flushes the output buffers, reports the --output-stats counters, and
+ * frees the buffers.
+ */
+void mysh_output_free(void)
+{
+    mysh_flush();
+    if(outputStats.enabled)
+    {
+        mysh_out(2, "     output: %lu bytes in %lu writes for %lu calls\n",
+                outputStats.bytes, outputStats.syscalls, outputStats.calls);
+        mysh_flush();
+    }
+    for(int fd = 1; fd < 3; fd++)
+    {
+        free(shellOutput[fd].data);
+        shellOutput[fd].data = NULL;
+    }
+}//end mysh_output_free
+
+/*mysh_hash
+ *
+ * FNV-1a over the first length bytes of name.
+ *
+ * @params name The variable name (Need not be null terminated)
+ * @params length Number of bytes in the name
+ * @return The hash of the name
+ */
+static unsigned int mysh_hash(const char * name, size_t length)
+{
+    unsigned int hash = 2166136261u;
+    for(size_t i = 0; i < length; i++)
+    {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}//end mysh_hash
+
+/*mysh_valid_name
+ *
+ * Checks that the first length bytes of name form a legal variable name
+ * (A letter or underscore followed by letters, digits, or underscores).
+ *
+ * @return 1 If the name is legal
+ * @return 0 Otherwise
+ */
+static int mysh_valid_name(const char * name, size_t length)
+{
+    if(length == 0 || !(isalpha((unsigned char)name[0]) || name[0] == '_'))
+    {
+        return 0;
+    }
+    for(size_t i = 1; i < length; i++)
+    {
+        if(!(isalnum((unsigned char)name[i]) || name[i] == '_'))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}//end mysh_valid_name
+
+/*mysh_var_slot
+ *
+ * Probes the variable table for name. If the name is not present the
+ * first reusable slot along the probe sequence is returned instead so
+ * that the caller may insert there.
+ *
+ * @return The matching slot, or the slot a new entry belongs in
+ */
+static Variable * mysh_var_slot(const char * name, size_t length,
+        unsigned int hash)
+{
+    int mask = shellVariables.capacity - 1;
+    Variable * reusable = NULL;
+    for(int i = hash & mask; ; i = (i + 1) & mask)
+    {
+        Variable * slot = &shellVariables.slots[i];
+        if(slot->pair == NULL)
+        {
+            return reusable ? reusable : slot;
+        }
+        if(slot->pair == TOMBSTONE)
+        {
+            if(!reusable)
+            {
+                reusable = slot;
+            }
+        }
+        else if(slot->hash == hash && slot->nameLength == length &&
+                !memcmp(slot->pair, name, length))
+        {
+            return slot;
+        }
+    }
+}//end mysh_var_slot
+
+/*mysh_var_grow
+ *
+ * Rehashes the variable table into one with newCapacity slots, dropping
+ * any tombstones along the way.
+ */
+static void mysh_var_grow(int newCapacity)
+{
+    Variable * old = shellVariables.slots;
+    int oldCapacity = shellVariables.capacity;
+    shellVariables.slots = (Variable *) calloc(newCapacity, sizeof(Variable));
+    shellVariables.capacity = newCapacity;
+    shellVariables.used = shellVariables.live;
+    for(int i = 0; i < oldCapacity; i++)
+    {
+        if(old[i].pair != NULL && old[i].pair != TOMBSTONE)
+        {
+            *mysh_var_slot(old[i].pair, old[i].nameLength, old[i].hash) = old[i];
+        }
+    }
+    free(old);
+}//end mysh_var_grow
+
+/*mysh_getvar
+ *
+ * Looks up a shell variable.
+ *
+ * @return The value of the variable, or NULL if it is not set
+ */
+const char * mysh_getvar(const char * name, size_t length)
+{
+    if(shellVariables.live == 0)
+    {
+        return NULL;
+    }
+    Variable * slot = mysh_var_slot(name, length, mysh_hash(name, length));
+    if(slot->pair == NULL || slot->pair == TOMBSTONE ||
+            slot->pair[slot->nameLength] != '=')
+    {
+        return NULL;
+    }
+    return slot->pair + slot->nameLength + 1;
+}//end mysh_getvar
+
+/*mysh_setvar
+ *
+ * Sets (or creates) a shell variable. The cached environment is only
+ * invalidated when the variable is, or becomes, exported. Exporting a name
+ * that is not set yet records it as exported but unset, so that a later
+ * NAME=value goes into the environment.
+ *
+ * @params value The new value; NULL keeps the current value (export NAME)
+ * @params exported Nonzero marks the variable for export
+ * @return 0 Upon success
+ * @return 1 If the name is not legal
+ */
+int mysh_setvar(const char * name, size_t length, const char * value,
+        int exported)
+{
+    if(!mysh_valid_name(name, length))
+    {
+        return 1;
+    }
+    if((shellVariables.used + 1) * 4 > shellVariables.capacity * 3)
+    {
+        mysh_var_grow(shellVariables.live * 2 >= shellVariables.capacity ?
+                shellVariables.capacity * 2 : shellVariables.capacity);
+    }
+    unsigned int hash = mysh_hash(name, length);
+    Variable * slot = mysh_var_slot(name, length, hash);
+    int present = slot->pair != NULL && slot->pair != TOMBSTONE;
+    if(!present && value == NULL && !exported)
+    {
+        return 0;
+    }
+    if(value != NULL || !present)
+    {
+        size_t valueLength = value ? strlen(value) : 0;
+        char * pair = (char *) malloc(length + valueLength + 2);
+        memcpy(pair, name, length);
+        pair[length] = value ? '=' : '\0';
+        memcpy(pair + length + 1, value ? value : "", valueLength + 1);
+        if(present)
+        {
+            free(slot->pair);
+        }
+        else
+        {
+            if(slot->pair == NULL)
+            {
+                shellVariables.used++;
+            }
+            shellVariables.live++;
+            slot->nameLength = length;
+            slot->hash = hash;
+            slot->exported = 0;
+        }
+        slot->pair = pair;
+    }
+    if(exported)
+    {
+        slot->exported = 1;
+    }
+    if(slot->exported)
+    {
+        shellVariables.envpDirty = 1;
+    }
+    if(length == 4 && !memcmp(name, "PATH", 4))
+    {
+        mysh_forget_paths();
+    }
+    return 0;
+}//end mysh_setvar
+
+/*mysh_unsetvar
+ *
+ * Removes a shell variable, leaving a tombstone in its slot.
+ *
+ * @return 0 Always; unsetting a missing variable is not an error
+ */
+int mysh_unsetvar(const char * name, size_t length)
+{
+    if(shellVariables.live == 0)
+    {
+        return 0;
+    }
+    Variable * slot = mysh_var_slot(name, length, mysh_hash(name, length));
+    if(slot->pair != NULL && slot->pair != TOMBSTONE)
+    {
+        if(slot->exported)
+        {
+            shellVariables.envpDirty = 1;
+        }
+        free(slot->pair);
+        slot->pair = TOMBSTONE;
+        shellVariables.live--;
+        if(length == 4 && !memcmp(name, "PATH", 4))
+        {
+            mysh_forget_paths();
+        }
+    }
+    return 0;
+}//end mysh_unsetvar
+
+/*mysh_environment
+ *
+ * Returns the environment handed to exec. The array points straight at the
+ * "NAME=value" strings in the table and is only rebuilt after an exported
+ * variable has changed, so launching a command costs nothing extra.
+ *
+ * @return A NULL terminated envp array
+ */
+char ** mysh_environment(void)
+{
+    if(shellVariables.envpDirty)
+    {
+        int count = 0;
+        free(shellVariables.envp);
+        shellVariables.envp = (char **) malloc(sizeof(char *) *
+                (shellVariables.live + 1));
+        for(int i = 0; i < shellVariables.capacity; i++)
+        {
+            Variable * slot = &shellVariables.slots[i];
+            if(slot->pair != NULL && slot->pair != TOMBSTONE &&
+                    slot->exported && slot->pair[slot->nameLength] == '=')
+            {
+                shellVariables.envp[count++] = slot->pair;
+            }
+        }
+        shellVariables.envp[count] = NULL;
+        shellVariables.envpDirty = 0;
+    }
+    return shellVariables.envp;
+}//end mysh_environment
+
+/*mysh_variables_init
+ *
+ * Builds the variable table and fills it with the environment the shell
+ * was started with; all of those variables are exported.
+ */
+void mysh_variables_init(char ** environment)
+{
+    shellVariables.capacity = VARIABLES_MIN;
+    shellVariables.slots = (Variable *) calloc(VARIABLES_MIN, sizeof(Variable));
+    shellVariables.envpDirty = 1;
+    for(char ** entry = environment; entry && *entry; entry++)
+    {
+        char * equals = strchr(*entry, '=');
+        if(equals != NULL)
+        {
+            mysh_setvar(*entry, equals - *entry, equals + 1, 1);
+        }
+    }
+}//end mysh_variables_init
+
+/*mysh_variables_free
+ *
+ * Frees the variable table and the cached environment.
+ */
+void mysh_variables_free(void)
+{
+    for(int i = 0; i < shellVariables.capacity; i++)
+    {
+        if(shellVariables.slots[i].pair != TOMBSTONE)
+        {
+            free(shellVariables.slots[i].pair);
+        }
+    }
+    free(shellVariables.slots);
+    free(shellVariables.envp);
+    memset(&shellVariables, 0, sizeof(shellVariables));
+}//end mysh_variables_free
+
+/*mysh_expand
+ *
+ * Replaces every $NAME and ${NAME} in line with the value of the variable
+ * (Or nothing if it is unset). A '$' that does not start a name is kept.
+ *
+ * @params line The raw command line
+ * @return A newly allocated, expanded copy of the line
+ */
+char * mysh_expand(const char * line)
+{
+    size_t size = strlen(line) + 1;
+    size_t length = 0;
+    char * expanded = (char *) malloc(size);
+    while(*line)
+    {
+        const char * value = NULL;
+        size_t valueLength = 1;
+        if(line[0] == '$')
+        {
+            const char * name = line + 1;
+            int braced = (*name == '{');
+            size_t nameLength = 0;
+            name += braced;
+            while(isalnum((unsigned char)name[nameLength]) ||
+                    name[nameLength] == '_')
+            {
+                nameLength++;
+            }
+            if(mysh_valid_name(name, nameLength) &&
+                    (!braced || name[nameLength] == '}'))
+            {
+                value = mysh_getvar(name, nameLength);
+                value = value ? value : "";
+                valueLength = strlen(value);
+                line = name + nameLength + braced;
+            }
+        }
+        if(value == NULL)
+        {
+            value = line++;
+        }
+        if(length + valueLength + 1 > size)
+        {
+            size = (length + valueLength + 1) * 2;
+            expanded = (char *) realloc(expanded, size);
+        }
+        memcpy(expanded + length, value, valueLength);
+        length += valueLength;
+    }
+    expanded[length] = '\0';
+    return expanded;
+}//end mysh_expand
+
+/*mysh_assign
+ *
+ * Handles a line made up only of NAME=value words by setting each of them.
+ *
+ * @params arguments The tokenized command line
+ * @return 1 If the line was a list of assignments (And they were done)
+ * @return 0 If the line is a command
+ */
+int mysh_assign(char * arguments[])
+{
+    if(arguments[0] == NULL)
+    {
+        return 0;
+    }
+    for(char ** word = arguments; *word != NULL; word++)
+    {
+        char * equals = strchr(*word, '=');
+        if(equals == NULL || !mysh_valid_name(*word, equals - *word))
+        {
+            return 0;
+        }
+    }
+    for(char ** word = arguments; *word != NULL; word++)
+    {
+        char * equals = strchr(*word, '=');
+        mysh_setvar(*word, equals - *word, equals + 1, 0);
+    }
+    return 1;
+}//end mysh_assign
+
+/*mysh_remember
+ *
+ * Appends a line and its compiled program to the history list, dropping
+ * the oldest entry once the list is full. The history owns the program.
+ */
+void mysh_remember(History * holder, const char * line, Program * program)
+{
+    int slot = holder->commands;
+    if(holder->commands >= holder->commandHistoryMem)
+    {
+        slot = holder->commandHistoryMem - 1;
+        free(holder->commandHistory[0]);
+        free(holder->commandPrograms[0]);
+        memmove(holder->commandHistory, holder->commandHistory + 1,
+                sizeof(char *) * slot);
+        memmove(holder->commandPrograms, holder->commandPrograms + 1,
+                sizeof(Program *) * slot);
+    }
+    holder->commandHistory[slot] = strdup(line);
+    holder->commandPrograms[slot] = program;
+    holder->commands++;
+}//end mysh_remember
+
+typedef struct directoryListing
+{
+    char * path;            //Cache key; NULL marks an empty slot
+    unsigned int hash;
+    char ** names;          //Point into arena
+    unsigned char * types;  //d_type of each name
+    char * arena;
+    int count;
+} Directory;
+
+typedef struct globState
+{
+    Directory * slots;      //Per line directory cache (Open addressing)
+    int capacity;
+    int live;
+    char * dents;           //getdents64 batch buffer
+    char ** argv;           //Expanded arguments; NULL terminated
+    int count;
+    int size;
+    char * block;           //Chained blocks that hold matched paths
+    size_t blockUsed;
+    size_t blockSize;
+    int directoriesOnly;    //Pattern ended in '/'
+} Glob;
+
+struct mysh_dirent64
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+#define GLOB_DENTS (1 << 18)
+#define GLOB_BLOCK (1 << 16)
+
+/*mysh_has_magic
+ *
+ * @return 1 If the word contains any of the glob characters *, ?, or [
+ * @return 0 Otherwise
+ */
+static int mysh_has_magic(const char * word)
+{
+    return strpbrk(word, "*?[") != NULL;
+}//end mysh_has_magic
+
+/*mysh_match_bracket
+ *
+ * Matches c against the bracket expression starting just after the '['.
+ *
+ * @params end Receives the position after the closing ']'
+ * @return 1 If c is in the set, 0 if it is not, -1 if there is no ']'
+ */
+static int mysh_match_bracket(const char * set, unsigned char c,
+        const char ** end)
+{
+    int negate = (*set == '!' || *set == '^');
+    int matched = 0;
+    set += negate;
+    const char * start = set;
+    while(*set && (*set != ']' || set == start))
+    {
+        unsigned char low = *set;
+        unsigned char high = low;
+        if(set[1] == '-' && set[2] && set[2] != ']')
+        {
+            high = set[2];
+            set += 2;
+        }
+        if(low <= c && c <= high)
+        {
+            matched = 1;
+        }
+        set++;
+    }
+    if(*set != ']')
+    {
+        return -1;
+    }
+    *end = set + 1;
+    return matched != negate;
+}//end mysh_match_bracket
+
+/*mysh_match
+ *
+ * Matches a single path component against a pattern made of *, ?, [...]
+ * and literal characters. A '*' backtracks to the last star only, so the
+ * match is linear for the patterns people actually type.
+ *
+ * @return 1 If the name matches
+ * @return 0 Otherwise
+ */
+int mysh_match(const char * pattern, const char * name)
+{
+    const char * starPattern = NULL;
+    const char * starName = NULL;
+    while(*name)
+    {
+        const char * next = pattern + 1;
+        int matched = 0;
+        if(*pattern == '*')
+        {
+            starPattern = ++pattern;
+            starName = name;
+            continue;
+        }
+        else if(*pattern == '?')
+        {
+            matched = 1;
+        }
+        else if(*pattern == '[')
+        {
+            matched = mysh_match_bracket(pattern + 1, *name, &next);
+            if(matched < 0)
+            {
+                matched = (*name == '[');
+                next = pattern + 1;
+            }
+        }
+        else
+        {
+            matched = (*pattern && *pattern == *name);
+        }
+        if(matched)
+        {
+            pattern = next;
+            name++;
+        }
+        else if(starPattern)
+        {
+            pattern = starPattern;
+            name = ++starName;
+        }
+        else
+        {
+            return 0;
+        }
+    }
+    while(*pattern == '*')
+    {
+        pattern++;
+    }
+    return *pattern == '\0';
+}//end mysh_match
+
+/*mysh_glob_list
+ *
+ * Returns the listing of a directory, reading it with large getdents64
+ * batches the first time it is asked for and from the per line cache after
+ * that. Names starting with '.' are kept; "." and ".." are not.
+ *
+ * @params path The directory; "" means the current directory
+ * @return The listing, or NULL if the directory could not be read
+ */
+static Directory * mysh_glob_list(Glob * g, const char * path)
+{
+    size_t length = strlen(path);
+    unsigned int hash = mysh_hash(path, length);
+    if((g->live + 1) * 4 > g->capacity * 3)
+    {
+        Directory * old = g->slots;
+        int oldCapacity = g->capacity;
+        g->capacity = oldCapacity ? oldCapacity * 2 : 16;
+        g->slots = (Directory *) calloc(g->capacity, sizeof(Directory));
+        for(int i = 0; i < oldCapacity; i++)
+        {
+            if(old[i].path != NULL)
+            {
+                int j = old[i].hash & (g->capacity - 1);
+                while(g->slots[j].path != NULL)
+                {
+                    j = (j + 1) & (g->capacity - 1);
+                }
+                g->slots[j] = old[i];
+            }
+        }
+        free(old);
+    }
+    int i = hash & (g->capacity - 1);
+    while(g->slots[i].path != NULL)
+    {
+        if(g->slots[i].hash == hash && !strcmp(g->slots[i].path, path))
+        {
+            return g->slots[i].names ? &g->slots[i] : NULL;
+        }
+        i = (i + 1) & (g->capacity - 1);
+    }
+
+    Directory * dir = &g->slots[i];
+    dir->path = strdup(path);
+    dir->hash = hash;
+    g->live++;
+    int fd = open(length ? path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        return NULL;
+    }
+    if(g->dents == NULL)
+    {
+        g->dents = (char *) malloc(GLOB_DENTS);
+    }
+
+    size_t arenaSize = 4096;
+    size_t arenaUsed = 0;
+    int slots = 64;
+    size_t * offsets = (size_t *) malloc(sizeof(size_t) * slots);
+    dir->arena = (char *) malloc(arenaSize);
+    dir->types = (unsigned char *) malloc(slots);
+    long bytes;
+    while((bytes = syscall(SYS_getdents64, fd, g->dents, GLOB_DENTS)) > 0)
+    {
+        for(long at = 0; at < bytes; )
+        {
+            struct mysh_dirent64 * entry = (struct mysh_dirent64 *)(g->dents + at);
+            const char * name = entry->d_name;
+            at += entry->d_reclen;
+            if(name[0] == '.' && (name[1] == '\0' ||
+                    (name[1] == '.' && name[2] == '\0')))
+            {
+                continue;
+            }
+            size_t nameLength = strlen(name) + 1;
+            if(arenaUsed + nameLength > arenaSize)
+            {
+                arenaSize = (arenaUsed + nameLength) * 2;
+                dir->arena = (char *) realloc(dir->arena, arenaSize);
+            }
+            if(dir->count == slots)
+            {
+                slots *= 2;
+                offsets = (size_t *) realloc(offsets, sizeof(size_t) * slots);
+                dir->types = (unsigned char *) realloc(dir->types, slots);
+            }
+            memcpy(dir->arena + arenaUsed, name, nameLength);
+            offsets[dir->count] = arenaUsed;
+            dir->types[dir->count++] = entry->d_type;
+            arenaUsed += nameLength;
+        }
+    }
+    close(fd);
+
+    //The arena has stopped moving; turn the offsets into pointers
+    dir->names = (char **) offsets;
+    for(int n = 0; n < dir->count; n++)
+    {
+        dir->names[n] = dir->arena + offsets[n];
+    }
+    return dir;
+}//end mysh_glob_list
+
+/*mysh_glob_add
+ *
+ * Appends a word to the expanded argument list. When copy is set the word
+ * is copied into the block storage owned by the glob state.
+ */
+static void mysh_glob_add(Glob * g, char * word, size_t length, int copy)
+{
+    if(copy)
+    {
+        if(g->block == NULL || g->blockUsed + length + 1 > g->blockSize)
+        {
+            size_t size = GLOB_BLOCK > length + 1 + sizeof(char *) ?
+                    GLOB_BLOCK : length + 1 + sizeof(char *);
+            char * block = (char *) malloc(size);
+            *(char **)block = g->block;
+            g->block = block;
+            g->blockSize = size;
+            g->blockUsed = sizeof(char *);
+        }
+        char * saved = g->block + g->blockUsed;
+        memcpy(saved, word, length);
+        saved[length] = '\0';
+        g->blockUsed += length + 1;
+        word = saved;
+    }
+    if(g->count + 1 >= g->size)
+    {
+        g->size = g->size ? g->size * 2 : 64;
+        g->argv = (char **) realloc(g->argv, sizeof(char *) * g->size);
+    }
+    g->argv[g->count++] = word;
+}//end mysh_glob_add
+
+/*mysh_glob_is_dir
+ *
+ * Uses the d_type from the listing and only falls back on stat when the
+ * file system did not supply one (Or the entry is a symbolic link that
+ * should be followed).
+ */
+static int mysh_glob_is_dir(unsigned char type, const char * path, int follow)
+{
+    struct stat info;
+    if(type == DT_DIR)
+    {
+        return 1;
+    }
+    if(type == DT_UNKNOWN)
+    {
+        return (follow ? stat(path, &info) : lstat(path, &info)) == 0 &&
+                S_ISDIR(info.st_mode);
+    }
+    return type == DT_LNK && follow && stat(path, &info) == 0 &&
+            S_ISDIR(info.st_mode);
+}//end mysh_glob_is_dir
+
+/*mysh_glob_walk
+ *
+ * Matches parts[part] and everything after it against the directory named
+ * by path (Which is empty or ends with a '/'). "**" matches any number of
+ * directories; used as the last part it matches everything below path.
+ */
+static void mysh_glob_walk(Glob * g, char * path, size_t length,
+        char ** parts, int part, int count)
+{
+    char * component = parts[part];
+    int last = (part == count - 1);
+    int globstar = !strcmp(component, "**");
+    size_t componentLength = strlen(component);
+
+    if(!globstar && !mysh_has_magic(component))
+    {
+        struct stat info;
+        if(length + componentLength + 2 > PATH_MAX)
+        {
+            return;
+        }
+        memcpy(path + length, component, componentLength + 1);
+        if(last)
+        {
+            if(g->directoriesOnly ? (stat(path, &info) == 0 &&
+                    S_ISDIR(info.st_mode)) : lstat(path, &info) == 0)
+            {
+                if(g->directoriesOnly)
+                {
+                    path[length + componentLength++] = '/';
+                }
+                mysh_glob_add(g, path, length + componentLength, 1);
+            }
+            return;
+        }
+        path[length + componentLength] = '/';
+        path[length + componentLength + 1] = '\0';
+        mysh_glob_walk(g, path, length + componentLength + 1, parts, part + 1, count);
+        return;
+    }
+    if(globstar && !last)
+    {
+        mysh_glob_walk(g, path, length, parts, part + 1, count);
+    }
+
+    path[length] = '\0';
+    Directory * dir = mysh_glob_list(g, path);
+    if(dir == NULL)
+    {
+        return;
+    }
+    for(int i = 0; i < dir->count; i++)
+    {
+        char * name = dir->names[i];
+        size_t nameLength = strlen(name);
+        if(name[0] == '.' && component[0] != '.')
+        {
+            continue;
+        }
+        if(!globstar && !mysh_match(component, name))
+        {
+            continue;
+        }
+        if(length + nameLength + 2 > PATH_MAX)
+        {
+            continue;
+        }
+        memcpy(path + length, name, nameLength + 1);
+        int isDir = (globstar || !last || g->directoriesOnly) ?
+                mysh_glob_is_dir(dir->types[i], path, !globstar) : 0;
+        if(last && (isDir || !g->directoriesOnly))
+        {
+            if(isDir && g->directoriesOnly)
+            {
+                path[length + nameLength] = '/';
+                nameLength++;
+            }
+            mysh_glob_add(g, path, length + nameLength, 1);
+            if(isDir && g->directoriesOnly)
+            {
+                nameLength--;
+            }
+        }
+        if(isDir && (globstar || !last))
+        {
+            path[length + nameLength] = '/';
+            path[length + nameLength + 1] = '\0';
+            mysh_glob_walk(g, path, length + nameLength + 1, parts,
+                    globstar ? part : part + 1, count);
+        }
+    }
+}//end mysh_glob_walk
+
+static int mysh_glob_compare(const void * left, const void * right)
+{
+    return strcmp(*(char * const *)left, *(char * const *)right);
+}
+
+/*mysh_glob
+ *
+ * Expands every argument that contains *, ?, [...] or ** into the sorted
+ * list of paths it matches. Arguments without matches are passed through
+ * untouched, as are all of the plain ones. Directory listings are cached
+ * for the life of the glob state, so several patterns over the same tree
+ * only read it once.
+ *
+ * @params g The glob state; must start zeroed and be freed by mysh_glob_free
+ * @params arguments The tokenized command line
+ * @return The expanded, NULL terminated argument vector
+ */
+char ** mysh_glob(Glob * g, char * arguments[])
+{
+    for(char ** word = arguments; *word != NULL; word++)
+    {
+        if(!mysh_has_magic(*word) || strlen(*word) >= PATH_MAX)
+        {
+            mysh_glob_add(g, *word, 0, 0);
+            continue;
+        }
+        char pattern[PATH_MAX];
+        char path[PATH_MAX];
+        char * parts[PATH_MAX / 2];
+        int count = 0;
+        int first = g->count;
+        strcpy(pattern, *word);
+        for(char * part = strtok(pattern, "/"); part; part = strtok(NULL, "/"))
+        {
+            parts[count++] = part;
+        }
+        strcpy(path, (*word)[0] == '/' ? "/" : "");
+        g->directoriesOnly = (*word)[strlen(*word) - 1] == '/';
+        if(count > 0)
+        {
+            mysh_glob_walk(g, path, strlen(path), parts, 0, count);
+        }
+        if(g->count == first)
+        {
+            mysh_glob_add(g, *word, 0, 0);
+        }
+        else
+        {
+            qsort(g->argv + first, g->count - first, sizeof(char *),
+                    mysh_glob_compare);
+        }
+    }
+    mysh_glob_add(g, NULL, 0, 0);
+    g->count--;
+    return g->argv;
+}//end mysh_glob
+
+/*mysh_glob_free
+ *
+ * Frees the expanded arguments and the directory cache.
+ */
+void mysh_glob_free(Glob * g)
+{
+    for(int i = 0; i < g->capacity; i++)
+    {
+        free(g->slots[i].path);
+        free(g->slots[i].names);
+        free(g->slots[i].types);
+        free(g->slots[i].arena);
+    }
+    while(g->block != NULL)
+    {
+        char * next = *(char **)g->block;
+        free(g->block);
+        g->block = next;
+    }
+    free(g->slots);
+    free(g->dents);
+    free(g->argv);
+    memset(g, 0, sizeof(Glob));
+}//end mysh_glob_free
+
+typedef struct commandEntry
+{
+    char * name;            //NULL marks an empty slot
+    char * path;
+    unsigned int hash;
+} Command;
+
+typedef struct commandCache
+{
+    Command * slots;        //Open addressing, linear probing
+    int capacity;
+    int live;
+} Commands;
+
+static Commands commandPaths;
+
+/*mysh_forget_paths
+ *
+ * Empties the PATH cache; called whenever PATH itself changes.
+ */
+void mysh_forget_paths(void)
+{
+    for(int i = 0; i < commandPaths.capacity; i++)
+    {
+        free(commandPaths.slots[i].name);
+        free(commandPaths.slots[i].path);
+    }
+    free(commandPaths.slots);
+    memset(&commandPaths, 0, sizeof(commandPaths));
+}//end mysh_forget_paths
+
+/*mysh_path_search
+ *
+ * Searches the directories in the shell's PATH variable (Not the
+ * environment the shell was started with) for an executable file.
+ *
+ * @return A newly allocated path to the program, or NULL if none was found
+ */
+static char * mysh_path_search(const char * name, size_t length)
+{
+    const char * search = mysh_getvar("PATH", 4);
+    char candidate[PATH_MAX];
+    char * found = NULL;
+    while(search != NULL && found == NULL)
+    {
+        const char * colon = strchr(search, ':');
+        size_t dirLength = colon ? (size_t)(colon - search) : strlen(search);
+        if(dirLength + length + 2 <= PATH_MAX)
+        {
+            struct stat info;
+            memcpy(candidate, dirLength ? search : ".", dirLength ? dirLength : 1);
+            dirLength = dirLength ? dirLength : 1;
+            candidate[dirLength] = '/';
+            strcpy(candidate + dirLength + 1, name);
+            if(access(candidate, X_OK) == 0 && stat(candidate, &info) == 0 &&
+                    S_ISREG(info.st_mode))
+            {
+                found = strdup(candidate);
+            }
+        }
+        search = colon ? colon + 1 : NULL;
+    }
+    return found;
+}//end mysh_path_search
+
+/*mysh_which
+ *
+ * Resolves a command name against PATH, remembering the answer so that a
+ * long running shell only searches PATH once per command. Names that
+ * contain a '/' are not looked up, and misses are not cached so newly
+ * installed programs are still found.
+ *
+ * @return The full path of the program, or NULL if it was not found
+ */
+const char * mysh_which(const char * name)
+{
+    size_t length = strlen(name);
+    if(strchr(name, '/') != NULL)
+    {
+        return NULL;
+    }
+    unsigned int hash = mysh_hash(name, length);
+    if(commandPaths.capacity)
+    {
+        int mask = commandPaths.capacity - 1;
+        for(int i = hash & mask; commandPaths.slots[i].name; i = (i + 1) & mask)
+        {
+            if(commandPaths.slots[i].hash == hash &&
+                    !strcmp(commandPaths.slots[i].name, name))
+            {
+                return commandPaths.slots[i].path;
+            }
+        }
+    }
+
+    char * found = mysh_path_search(name, length);
+    if(found == NULL)
+    {
+        return NULL;
+    }
+
+    if((commandPaths.live + 1) * 4 > commandPaths.capacity * 3)
+    {
+        Command * old = commandPaths.slots;
+        int oldCapacity = commandPaths.capacity;
+        commandPaths.capacity = oldCapacity ? oldCapacity * 2 : 64;
+        commandPaths.slots = (Command *) calloc(commandPaths.capacity,
+                sizeof(Command));
+        for(int i = 0; i < oldCapacity; i++)
+        {
+            if(old[i].name != NULL)
+            {
+                int j = old[i].hash & (commandPaths.capacity - 1);
+                while(commandPaths.slots[j].name != NULL)
+                {
+                    j = (j + 1) & (commandPaths.capacity - 1);
+                }
+                commandPaths.slots[j] = old[i];
+            }
+        }
+        free(old);
+    }
+    int i = hash & (commandPaths.capacity - 1);
+    while(commandPaths.slots[i].name != NULL)
+    {
+        i = (i + 1) & (commandPaths.capacity - 1);
+    }
+    commandPaths.slots[i].name = strdup(name);
+    commandPaths.slots[i].path = found;
+    commandPaths.slots[i].hash = hash;
+    commandPaths.live++;
+    return found;
+}//end mysh_which
+
+/*mysh_spawn
+ *
+ * Forks and execs a command with the shell's cached environment. Names
+ * with a '/' are run as they are; anything else is looked up through the
+ * PATH cache, and if the cached path has gone stale the child searches the
+ * shell's PATH again. The environment the shell was started with is never
+ * searched, so an unset or changed PATH takes effect.
+ *
+ * @params words The NULL terminated argument vector
+ * @params fds Descriptors the child uses as stdin, stdout, and stderr; NULL
+ * (Or a -1 entry) keeps the shell's own
+ * @return The pid of the child, or -1 if the fork failed
+ */
+pid_t mysh_spawn(char ** words, const int * fds)
+{
+    const char * path = mysh_which(words[0]);
+    char ** envp = mysh_environment();
+    mysh_flush();
+    pid_t pid = fork();
+    if(pid == 0)
+    {
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+        for(int i = 0; fds != NULL && i < 3; i++)
+        {
+            if(fds[i] >= 0 && fds[i] != i)
+            {
+                dup2(fds[i], i);
+            }
+        }
+        if(path == NULL && strchr(words[0], '/') != NULL)
+        {
+            execve(words[0], words, envp);
+        }
+        else if(path != NULL)
+        {
+            execve(path, words, envp);
+            char * fresh = mysh_path_search(words[0], strlen(words[0]));
+            if(fresh != NULL && strcmp(fresh, path))
+            {
+                execve(fresh, words, envp);
+            }
+        }
+        mysh_out(2, "     %s: No such file or directory\n", words[0]);
+        mysh_flush();
+        _exit(EXIT_FAILURE);
+    }
+    return pid;
+}//end mysh_spawn
+
+//Lists are right linked chains (a ; (b ; c)) so they run in a loop. In an
+//&&/|| chain the node's type is the operator between left and what follows
+#define NODE_SIMPLE 0       //left: first word, right: word count
+#define NODE_SEQUENCE 1     //left ; right
+#define NODE_AND 2          //left && right
+#define NODE_OR 3           //left || right
+#define NODE_SUBSHELL 4     //( left )
+
+#define MAX_NESTING 256     //Deepest ( ... ) the parser accepts
+
+#define TOKEN_END 0
+#define TOKEN_WORD 1
+#define TOKEN_NEWLINE 2
+#define TOKEN_SEMI 3
+#define TOKEN_AND 4
+#define TOKEN_OR 5
+#define TOKEN_OPEN 6
+#define TOKEN_CLOSE 7
+
+typedef struct commandNode
+{
+    int type;
+    int left;
+    int right;
+} Node;
+
+struct commandProgram
+{
+    Node * nodes;           //Both arrays and the word text share the block
+    char ** words;          //that holds this struct, so one free releases it
+    int nodeCount;
+    int wordCount;
+    int root;               //-1 for an empty program
+};
+
+typedef struct commandParser
+{
+    const char * at;
+    int token;
+    const char * tokenStart;
+    size_t tokenLength;
+    Node * nodes;
+    int nodeCount;
+    int nodeSize;
+    size_t * words;         //Offsets into text until the program is built
+    int wordCount;
+    int wordSize;
+    char * text;
+    size_t textUsed;
+    size_t textSize;
+    int nesting;            //Open ( ... ) around the current token
+    int failed;
+} Parser;
+
+/*mysh_lex
+ *
+ * Reads the next token. Words run until whitespace, ';', '(', ')', "&&",
+ * or "||"; a lone '&' or '|' is part of a word. A '#' at the start of a
+ * word comments out the rest of the line.
+ */
+static void mysh_lex(Parser * p)
+{
+    while(*p->at == ' ' || *p->at == '\t' || *p->at == '\r')
+    {
+        p->at++;
+    }
+    if(*p->at == '#')
+    {
+        while(*p->at && *p->at != '\n')
+        {
+            p->at++;
+        }
+    }
+    p->tokenStart = p->at;
+    p->tokenLength = 1;
+    switch(*p->at)
+    {
+        case '\0':
+            p->token = TOKEN_END;
+            p->tokenLength = 0;
+            return;
+        case '\n':
+            p->token = TOKEN_NEWLINE;
+            break;
+        case ';':
+            p->token = TOKEN_SEMI;
+            break;
+        case '(':
+            p->token = TOKEN_OPEN;
+            break;
+        case ')':
+            p->token = TOKEN_CLOSE;
+            break;
+        default:
+            if((p->at[0] == '&' || p->at[0] == '|') && p->at[1] == p->at[0])
+            {
+                p->token = p->at[0] == '&' ? TOKEN_AND : TOKEN_OR;
+                p->tokenLength = 2;
+                break;
+            }
+            p->token = TOKEN_WORD;
+            p->tokenLength = 0;
+            while(p->at[p->tokenLength] && !strchr(" \t\r\n;()",
+                    p->at[p->tokenLength]) &&
+                    !((p->at[p->tokenLength] == '&' ||
+                    p->at[p->tokenLength] == '|') &&
+                    p->at[p->tokenLength + 1] == p->at[p->tokenLength]))
+            {
+                p->tokenLength++;
+            }
+            break;
+    }
+    p->at += p->tokenLength;
+}//end mysh_lex
+
+/*mysh_syntax_error
+ *
+ * Reports the token the parser choked on; only the first error is shown.
+ */
+static int mysh_syntax_error(Parser * p)
+{
+    if(!p->failed)
+    {
+        if(p->token == TOKEN_END || p->token == TOKEN_NEWLINE)
+        {
+            mysh_out(2, "     syntax error: unexpected end of line\n");
+        }
+        else
+        {
+            mysh_out(2, "     syntax error near '%.*s'\n",
+                    (int)p->tokenLength, p->tokenStart);
+        }
+    }
+    p->failed = 1;
+    return -1;
+}//end mysh_syntax_error
+
+/*mysh_node
+ *
+ * Appends a node to the program being built.
+ *
+ * @return The index of the new node
+ */
+static int mysh_node(Parser * p, int type, int left, int right)
+{
+    if(p->nodeCount == p->nodeSize)
+    {
+        p->nodeSize = p->nodeSize ? p->nodeSize * 2 : 16;
+        p->nodes = (Node *) realloc(p->nodes, sizeof(Node) * p->nodeSize);
+    }
+    p->nodes[p->nodeCount].type = type;
+    p->nodes[p->nodeCount].left = left;
+    p->nodes[p->nodeCount].right = right;
+    return p->nodeCount++;
+}//end mysh_node
+
+/*mysh_chain
+ *
+ * Adds next to the end of a right linked chain of type nodes. head starts
+ * as the first item of the chain and tail as -1.
+ */
+static void mysh_chain(Parser * p, int type, int * head, int * tail, int next)
+{
+    if(*tail < 0)
+    {
+        *head = *tail = mysh_node(p, type, *head, next);
+        return;
+    }
+    int link = mysh_node(p, type, p->nodes[*tail].right, next);
+    p->nodes[*tail].right = link;
+    *tail = link;
+}//end mysh_chain
+
+static int mysh_parse_list(Parser * p);
+
+/*mysh_parse_command
+ *
+ * command := word word ... | '(' list ')'
+ */
+static int mysh_parse_command(Parser * p)
+{
+    if(p->token == TOKEN_OPEN)
+    {
+        if(p->nesting == MAX_NESTING)
+        {
+            mysh_out(2, "     syntax error: ( ... ) nested too deeply\n");
+            p->failed = 1;
+            return -1;
+        }
+        mysh_lex(p);
+        p->nesting++;
+        int inner = mysh_parse_list(p);
+        p->nesting--;
+        if(p->failed)
+        {
+            return -1;
+        }
+        if(inner < 0 || p->token != TOKEN_CLOSE)
+        {
+            return mysh_syntax_error(p);
+        }
+        mysh_lex(p);
+        return mysh_node(p, NODE_SUBSHELL, inner, 0);
+    }
+    if(p->token != TOKEN_WORD)
+    {
+        return mysh_syntax_error(p);
+    }
+    int first = p->wordCount;
+    while(p->token == TOKEN_WORD)
+    {
+        if(p->wordCount == p->wordSize)
+        {
+            p->wordSize = p->wordSize ? p->wordSize * 2 : 16;
+            p->words = (size_t *) realloc(p->words, sizeof(size_t) * p->wordSize);
+        }
+        if(p->textUsed + p->tokenLength + 1 > p->textSize)
+        {
+            p->textSize = (p->textUsed + p->tokenLength + 1) * 2;
+            p->text = (char *) realloc(p->text, p->textSize);
+        }
+        memcpy(p->text + p->textUsed, p->tokenStart, p->tokenLength);
+        p->text[p->textUsed + p->tokenLength] = '\0';
+        p->words[p->wordCount++] = p->textUsed;
+        p->textUsed += p->tokenLength + 1;
+        mysh_lex(p);
+    }
+    return mysh_node(p, NODE_SIMPLE, first, p->wordCount - first);
+}//end mysh_parse_command
+
+/*mysh_parse_and_or
+ *
+ * and_or := command (('&&' | '||') newline* command)*
+ */
+static int mysh_parse_and_or(Parser * p)
+{
+    int node = mysh_parse_command(p);
+    int tail = -1;
+    while(!p->failed && (p->token == TOKEN_AND || p->token == TOKEN_OR))
+    {
+        int type = p->token == TOKEN_AND ? NODE_AND : NODE_OR;
+        do
+        {
+            mysh_lex(p);
+        } while(p->token == TOKEN_NEWLINE);
+        mysh_chain(p, type, &node, &tail, mysh_parse_command(p));
+    }
+    return node;
+}//end mysh_parse_and_or
+
+/*mysh_parse_list
+ *
+ * list := and_or ((';' | newline) and_or)*, allowing empty entries.
+ *
+ * @return The root of the list, or -1 if it is empty
+ */
+static int mysh_parse_list(Parser * p)
+{
+    int node = -1;
+    int tail = -1;
+    while(!p->failed)
+    {
+        while(p->token == TOKEN_SEMI || p->token == TOKEN_NEWLINE)
+        {
+            mysh_lex(p);
+        }
+        if(p->token == TOKEN_END || p->token == TOKEN_CLOSE)
+        {
+            break;
+        }
+        int next = mysh_parse_and_or(p);
+        if(node < 0)
+        {
+            node = next;
+        }
+        else
+        {
+            mysh_chain(p, NODE_SEQUENCE, &node, &tail, next);
+        }
+        if(p->token != TOKEN_SEMI && p->token != TOKEN_NEWLINE)
+        {
+            break;
+        }
+    }
+    return node;
+}//end mysh_parse_list
+
+/*mysh_compile
+ *
+ * Parses a command line (Or a whole script) once into a program that
+ * mysh_run can execute any number of times. Nodes, word pointers, and the
+ * word text are packed into a single allocation.
+ *
+ * @params text The source; newlines separate commands like ';' does
+ * @return The program (Free it with free), or NULL on a syntax error
+ */
+Program * mysh_compile(const char * text)
+{
+    Parser p;
+    memset(&p, 0, sizeof(p));
+    p.at = text;
+    mysh_lex(&p);
+    int root = mysh_parse_list(&p);
+    if(!p.failed && p.token != TOKEN_END)
+    {
+        mysh_syntax_error(&p);
+    }
+
+    Program * program = NULL;
+    if(!p.failed)
+    {
+        size_t nodeBytes = sizeof(Node) * p.nodeCount;
+        size_t wordBytes = sizeof(char *) * p.wordCount;
+        program = (Program *) malloc(sizeof(Program) + nodeBytes + wordBytes +
+                p.textUsed);
+        program->words = (char **)(program + 1);
+        program->nodes = (Node *)((char *)program->words + wordBytes);
+        char * words = (char *)program->nodes + nodeBytes;
+        if(nodeBytes)
+        {
+            memcpy(program->nodes, p.nodes, nodeBytes);
+        }
+        if(p.textUsed)
+        {
+            memcpy(words, p.text, p.textUsed);
+        }
+        for(int i = 0; i < p.wordCount; i++)
+        {
+            program->words[i] = words + p.words[i];
+        }
+        program->nodeCount = p.nodeCount;
+        program->wordCount = p.wordCount;
+        program->root = root;
+    }
+    free(p.nodes);
+    free(p.words);
+    free(p.text);
+    return program;
+}//end mysh_compile
+
+/*mysh_help
+ *
+ *The internal help function for mysh. When called it prints text explaining
+ *how to use each of the internal commands as well as what each command does
+ *
+ * @params argc Used to pass in the verbose flag (Not used in this function
+ * @params argv Used to pass in the history struct (Not used in this function)
+ * @return 0 Signals the success of the help command
+ */
+int mysh_help(int argc, char * argv[])
+{
+    if(argc)
+    {
+        mysh_out(1, "     COMMAND: help => processing!");
+    }
+    static const char helpText[] =
+        "Internal Commands:\n"
+        "!N:      Rexecute the Nth command in the history list where N is a \n"
+        "         positive integer.\n"
+        "export:  Marks variables for export to commands. Takes NAME or \n"
+        "         NAME=value arguments; lists exported variables if none.\n"
+        "help:    Outputs this text.\n"
+        "history: Outputs the list of commands entered. Only 'remembers' a \n"
+        "         certain number of commands.The value can be set when first \n"
+        "         running the shell using the -h flag and specifying a  \n"
+        "         positive integer afterwards. The default integer is 10. \n"
+        "quit:    Deallocs all memory in use by the shell and then cleanly \n"
+        "         terminates the shell.\n"
+        "unset:   Removes the named shell variables.\n"
+        "verbose: Toggle verbose mode in the shell. Can be set when the shell \n"
+        "         is first run by using the -v flag. Verbose takes 'on' or  \n"
+        "         'off' as arguments.\n"
+        "NAME=value sets a shell variable; $NAME and ${NAME} expand to it.\n";
+    mysh_write(1, helpText, sizeof(helpText) - 1);
+    return 0;
+}//end mysh_help
+
+/*mysh_history
+ *
+ * Returns the list of commands that the user entered in to the terminal up
+ * to a certain amount (Defined by the user or 10 by default).
+ *
+ * @params argc The verbose flag; used for print extra information to stdout
+ * @params argv The history struct; contains the command list and the history
+ * value
+ * @return 0 Upon success
+ */
+int mysh_history(int argc, char * argv[])
+{
+    if(argc)
+    {
+        mysh_out(1, "     COMMAND: history => processing!");
+    }
+    History * holder = ((History *)argv);
+    int limit = holder->commandHistoryMem;
+    int formater = limit;
+    int commands = holder->commands;
+
+    if(commands < limit)
+    {
+        for(int i = 0; i < commands; i++)
+        {
+            mysh_out(1, "%d: %s", i, holder->commandHistory[i]);
+        }
+    }
+    else
+    {
+        for (int i = 0; i < limit; i++) {
+            mysh_out(1, "%d: %s", commands - formater, holder->commandHistory[i]);
+            formater--;
+        }
+    }
+    return 0;
+}//end mysh_history
+
+/*mysh_quit
+ *
+ * Frees the history struct and all of the command strings (And their
+ * compiled programs) within its list.
+ * It then signals for the termination of the shell upon it's success.
+ *
+ * @params argc The verbose flag; used to print extra information to stdout
+ * @params argv The history struct; contains the command list which must be
+ * freed along with the struct itself
+ * @return 0 Upon success
+ */
+int mysh_quit(int argc, char * argv[])
+{
+    if(argc)
+    {
+        mysh_out(1, "     COMMAND: quit => processing!\n");
+    }
 
-/*mysh_bang
+    for(int i = 0; i < ((History *)argv)->commandHistoryMem; i++)
+    {
+        free(((History *)argv)->commandHistory[i]);
+        free(((History *)argv)->commandPrograms[i]);
+    }
+    free(((History *)argv)->commandHistory);
+    free(((History *)argv)->commandPrograms);
+    free((History *)argv);
+    mysh_variables_free();
+    mysh_forget_paths();
+    return 0;
+}//end mysh_quit
+
+/*verbose
  *
- * The internal command that reads from the command history list
- * and reruns the Nth command (As specified by the user). If the
- * command is not within the history value limit then the user
- * will be informed that the command they are looking for does not
- * exist.
+ * Turns verbose mode on or off. Verbose mode on prints additional
+ * information to stdout. Off leaves all of the extra info off.
  *
- * @params argc The verbose flag; used to print extra information
- * to stdout
- * @params argv The history struct; contains the command list and
- * the history value.
- * @return 0 Upon success
- * @return 1 Upon failure
- * @return argc If verbose is called again (Toggles vmode)
- *  */
-int mysh_bang(int argc, char * argv[])
+ * @params argc The verbose flag; used to print extra information to stdout
+ * @params argv The command words; argv[1] is "on" or "off"
+ * @return 1 If user wants vmode on
+ * @return 0 If user wants vmode off
+ * @return argc Something went wrong (So change nothing!)
+ */
+int mysh_verbose(int argc, char * argv[])
 {
-    History * holder = (History *)argv;
-    int value = ((History *)argv)->commands - ((History *)argv)->commandHistoryMem;
     if(argc)
     {
-        printf("     COMMAND: bang => processing!\n");
+        mysh_out(1, "     COMMAND: verbose => processing!\n");
     }
-    int distance = 0;
-    char * inter;
-    if(holder->commands > holder->commandHistoryMem)
+    if(argv[1] != NULL && !strcmp(argv[1], "on"))
     {
-        inter = (char *) malloc(sizeof(char *) * strlen(
-                holder->commandHistory[holder->commandHistoryMem-1]) + 1);
+        return 1;
+    }
+    else if(argv[1] != NULL && !strcmp(argv[1], "off"))
+    {
+        return 0;
+    }
+    return argc;
+}//end mysh_verbose
 
-        for(int i = 1; i < (strlen(holder->commandHistory[
-                holder->commandHistoryMem-1]) + 1); i++)
+/*mysh_export
+ *
+ * Marks variables for export to the commands the shell runs. Each argument
+ * is either NAME or NAME=value. With no arguments the exported variables
+ * are listed.
+ *
+ * @params argc The verbose flag; used to print extra information to stdout
+ * @params argv The tokenized command line (argv[0] is "export")
+ * @return 0 Upon success
+ * @return 1 If any of the names were not legal
+ */
+int mysh_export(int argc, char * argv[])
+{
+    int result = 0;
+    if(argc)
+    {
+        mysh_out(1, "     COMMAND: export => processing!\n");
+    }
+    if(argv[1] == NULL)
+    {
+        for(int i = 0; i < shellVariables.capacity; i++)
         {
-            inter[i-1] = holder->commandHistory[holder->commandHistoryMem-1][i];
+            Variable * slot = &shellVariables.slots[i];
+            if(slot->pair != NULL && slot->pair != TOMBSTONE && slot->exported)
+            {
+                mysh_out(1, "export %s\n", slot->pair);
+            }
         }
+        return 0;
     }
-    else
+    for(int i = 1; argv[i] != NULL; i++)
     {
-        inter = (char *) malloc(sizeof(char *) * strlen(
-                holder->commandHistory[holder->commands - 1]) + 1);
-
-        for(int i = 1; i < (strlen(holder->commandHistory
-        [holder->commands-1]) + 1); i++)
+        char * equals = strchr(argv[i], '=');
+        size_t length = equals ? (size_t)(equals - argv[i]) : strlen(argv[i]);
+        if(mysh_setvar(argv[i], length, equals ? equals + 1 : NULL, 1))
         {
-            inter[i-1] = holder->commandHistory[holder->commands-1][i];
+            mysh_out(2, "     export: '%s': not a valid identifier\n", argv[i]);
+            result = 1;
         }
     }
-    sscanf(inter, "%d", &distance);
-    if(distance < ((History *)argv)->commands - ((History *)argv)->commandHistoryMem
-            || distance == ((History *)argv)->commands)
+    return result;
+}//end mysh_export
+
+/*mysh_unset
+ *
+ * Removes each of the named variables from the shell (And from the
+ * environment of later commands if they were exported).
+ *
+ * @params argc The verbose flag; used to print extra information to stdout
+ * @params argv The tokenized command line (argv[0] is "unset")
+ * @return 0 Upon success
+ */
+int mysh_unset(int argc, char * argv[])
+{
+    if(argc)
+    {
+        mysh_out(1, "     COMMAND: unset => processing!\n");
+    }
+    for(int i = 1; argv[i] != NULL; i++)
+    {
+        mysh_unsetvar(argv[i], strlen(argv[i]));
+    }
+    return 0;
+}//end mysh_unset
+
+/*mysh_history_program
+ *
+ * Looks up the compiled form of command number n, using the same
+ * numbering as mysh_history.
+ *
+ * @return The program, or NULL if the command is no longer remembered (Or
+ * did not compile)
+ */
+Program * mysh_history_program(History * holder, int n)
+{
+    int stored = holder->commands < holder->commandHistoryMem ?
+            holder->commands : holder->commandHistoryMem;
+    int first = holder->commands - stored;
+    if(n < first || n >= holder->commands)
+    {
+        return NULL;
+    }
+    return holder->commandPrograms[n - first];
+}//end mysh_history_program
+
+typedef struct shellState
+{
+    History * history;
+    int verbose;
+    int quit;               //Set by the quit command
+    int depth;              //Nested !N replays
+    const int * fds;        //stdin, stdout, stderr for commands; NULL for ours
+} Shell;
+
+#define BANG_DEPTH 16
+
+int mysh_run(Shell * shell, Program * program);
+
+/*mysh_bang
+ *
+ * The internal command that reruns the Nth command in the history list (As
+ * numbered by history). The command is replayed from the program compiled
+ * when it was first entered, so it is not parsed again. If the command is
+ * not within the history value limit then the user will be informed that
+ * the command they are looking for does not exist.
+ *
+ * @params shell The shell state; its verbose flag prints extra information
+ * @params argv The command words; argv[0] is "!N"
+ * @return The status of the replayed command
+ * @return 1 If there is no such command
+ */
+int mysh_bang(Shell * shell, char * argv[])
+{
+    if(shell->verbose)
+    {
+        mysh_out(1, "     COMMAND: bang => processing!\n");
+    }
+    char * end;
+    long distance = strtol(argv[0] + 1, &end, 10);
+    Program * program = NULL;
+    if(end != argv[0] + 1 && *end == '\0')
+    {
+        program = mysh_history_program(shell->history, distance);
+    }
+    if(program == NULL)
     {
+        mysh_out(2, "     %s: event not found\n", argv[0]);
         return 1;
     }
-    else
+    if(shell->depth >= BANG_DEPTH)
     {
-        char * command;
-        char * backup;
-        if(distance < holder->commands)
-        {
-            command = (char *) malloc(sizeof(char *) * strlen(
-                    holder->commandHistory[distance-1])+1);
+        mysh_out(2, "     %s: too many nested replays\n", argv[0]);
+        return 1;
+    }
+    shell->depth++;
+    int status = mysh_run(shell, program);
+    shell->depth--;
+    return status;
+}//end mysh_bang
 
-            backup = (char *) malloc(sizeof(char *) * strlen(
-                    holder->commandHistory[distance-1])+1);
+static const char * builtinNames[] =
+{
+    "export", "help", "history", "quit", "unset", "verbose", NULL
+};
 
-            strcpy(backup,holder->commandHistory[distance]);
-            sscanf(holder->commandHistory[distance],"%s",command);
-        }
-        else
+/*mysh_is_builtin
+ *
+ * @return 1 If name is one of the internal commands (Other than !N)
+ * @return 0 Otherwise
+ */
+int mysh_is_builtin(const char * name)
+{
+    for(const char ** builtin = builtinNames; *builtin != NULL; builtin++)
+    {
+        if(!strcmp(*builtin, name))
         {
-            command = (char *) malloc(sizeof(char *) * strlen(
-                    holder->commandHistory[distance - value -1])+1);
+            return 1;
+        }
+    }
+    return 0;
+}//end mysh_is_builtin
 
-            backup = (char *) malloc(sizeof(char *) * strlen(
-                    holder->commandHistory[distance - value - 1])+1);
+/*mysh_builtin
+ *
+ * Runs an internal command in the shell itself.
+ *
+ * @params arguments The expanded command words
+ * @return The status of the command
+ * @return -1 If arguments[0] is not an internal command
+ */
+int mysh_builtin(Shell * shell, char * arguments[])
+{
+    if(!strcmp(arguments[0], "help"))
+    {
+        return mysh_help(shell->verbose, NULL);
+    }
+    else if(!strcmp(arguments[0], "history"))
+    {
+        return mysh_history(shell->verbose, (char **)shell->history);
+    }
+    else if(!strcmp(arguments[0], "quit"))
+    {
+        shell->quit = 1;
+        return 0;
+    }
+    else if(!strcmp(arguments[0], "verbose"))
+    {
+        shell->verbose = mysh_verbose(shell->verbose, arguments);
+        return 0;
+    }
+    else if(!strcmp(arguments[0], "export"))
+    {
+        return mysh_export(shell->verbose, arguments);
+    }
+    else if(!strcmp(arguments[0], "unset"))
+    {
+        return mysh_unset(shell->verbose, arguments);
+    }
+    return -1;
+}//end mysh_builtin
 
-            strcpy(backup, holder->commandHistory[distance - value]);
-            sscanf(holder->commandHistory[distance - value], "%s", command);
+/*mysh_arguments
+ *
+ * Builds the arguments of a simple command from its compiled words. Words
+ * without a '$' are used as they are; only the ones that do are expanded
+ * and split on whitespace, so a replayed command is not lexed again.
+ *
+ * @params arguments Receives the NULL terminated arguments
+ * @return The buffer holding the expanded words (NULL if there were none);
+ * free it when done
+ */
+char * mysh_arguments(Program * program, Node * node, char * arguments[])
+{
+    char ** words = program->words + node->left;
+    size_t * offsets = NULL;
+    char * expanded = NULL;
+    size_t used = 0;
+    int count = 0;
+    for(int i = 0; i < node->right; i++)
+    {
+        if(strchr(words[i], '$') == NULL)
+        {
+            continue;
         }
-        if(!strcmp(command,"help"))
+        if(offsets == NULL)
         {
-            free(inter);
-            free(command);
-            mysh_help(argc, argv);
+            offsets = (size_t *) malloc(sizeof(size_t) * node->right);
         }
-        else if(!strcmp(command,"history"))
+        char * value = mysh_expand(words[i]);
+        size_t length = strlen(value) + 1;
+        expanded = (char *) realloc(expanded, used + length);
+        memcpy(expanded + used, value, length);
+        offsets[i] = used;
+        used += length;
+        free(value);
+    }
+
+    //The buffer has stopped moving; split the expansions in place
+    for(int i = 0; i < node->right && count < MAX_ARGUMENTS - 1; i++)
+    {
+        if(strchr(words[i], '$') == NULL)
         {
-            free(inter);
-            free(command);
-            mysh_history(argc, argv);
+            arguments[count++] = words[i];
+            continue;
         }
-        else if(!strcmp(command,"verbose"))
+        char * save;
+        char * temp = strtok_r(expanded + offsets[i], " \t\n", &save);
+        while(temp != NULL && count < MAX_ARGUMENTS - 1)
         {
-            free(inter);
-            free(command);
-            argc = mysh_verbose(argc, argv);
-            return argc;
+            arguments[count++] = temp;
+            temp = strtok_r(NULL, " \t\n", &save);
         }
-        else
+    }
+    arguments[count] = NULL;
+    free(offsets);
+    return expanded;
+}//end mysh_arguments
+
+/*mysh_status
+ *
+ * Turns a wait status into a shell exit status (128 + N if killed by
+ * signal N).
+ */
+int mysh_status(int status)
+{
+    return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+}//end mysh_status
+
+/*mysh_run_simple
+ *
+ * Runs a single command: a !N replay, a list of assignments, an internal
+ * command, or an external command through mysh_spawn.
+ *
+ * @return The status of the command
+ */
+static int mysh_run_simple(Shell * shell, Program * program, Node * node)
+{
+    if(program->words[node->left][0] == '!')
+    {
+        return mysh_bang(shell, program->words + node->left);
+    }
+    char * arguments[MAX_ARGUMENTS];
+    char * expanded = mysh_arguments(program, node, arguments);
+    int status = 0;
+    if(arguments[0] != NULL && !mysh_assign(arguments) &&
+            (status = mysh_builtin(shell, arguments)) < 0)
+    {
+        Glob glob = {0};
+        char ** words = mysh_glob(&glob, arguments);
+        char ** nextCommand;
+        pid_t pid;
+        pid_t usefulInfo = 0;
+        int waitStatus = 0;
+        if (shell->verbose)
         {
-            free(inter);
-            free(command);
-            char * arguments[1024];
-            char ** nextCommand = arguments;
-            char * temp = strtok(backup ," \n");
-            while (temp != NULL)
+            int counter = 0;
+            mysh_out(1, "     Input command tokens:\n");
+            for (nextCommand = words; *nextCommand != 0; nextCommand++)
             {
-                *nextCommand++ = temp;
-                temp = strtok(NULL, " \n");
+                mysh_out(1, "%d:", counter);
+                mysh_out(1, "%s\n", *nextCommand);
+                counter++;
             }
+        }
 
-            pid_t pid;
-            pid_t usefulInfo = 0;
-            int status = 0;
-            if (argc)
+        //Begin Fork and Exec Block
+        if ((pid = mysh_spawn(words, shell->fds)) < 0)
+        {
+            mysh_perror("Fork error; something has gone wrong!");
+            status = 1;
+        }
+        else //THIS IS THE PARENT
+        {
+            usefulInfo = waitpid(pid, &waitStatus, 0);
+            if (shell->verbose)
             {
-                int counter = 0;
-                printf("     Input command tokens:\n");
-                for (nextCommand = arguments; *nextCommand != 0; nextCommand++)
-                {
-                    printf("%d:", counter);
-                    puts(*nextCommand);
-                    counter++;
-                }
+                mysh_out(1, "     Parent waited on pid: %d\n", usefulInfo);
             }
+            status = mysh_status(waitStatus);
+        }//End Fork and Exec Block
+        mysh_glob_free(&glob);
+    }
+    free(expanded);
+    return status;
+}//end mysh_run_simple
 
-            //Begin Fork and Exec Block
-            if ((pid = fork()) < 0)
+/*mysh_run_node
+ *
+ * Runs one node of a program. A sequence stops early once quit has been
+ * run; in an && / || chain each command only runs when the status so far
+ * is a success (Or failure), so "a && b || c" is "(a && b) || c". A
+ * subshell runs in a forked copy of the shell, so changes it makes to
+ * variables and history do not leak out.
+ *
+ * @return The status of the last command run
+ */
+static int mysh_run_node(Shell * shell, Program * program, int index)
+{
+    Node * node = &program->nodes[index];
+    int status;
+    switch(node->type)
+    {
+        case NODE_SIMPLE:
+            return mysh_run_simple(shell, program, node);
+        case NODE_SEQUENCE:
+            //Walk the chain instead of recursing so long scripts are safe
+            while(node->type == NODE_SEQUENCE)
             {
-                perror("Fork error; something has gone wrong!");
+                mysh_run_node(shell, program, node->left);
+                if(shell->quit)
+                {
+                    return 0;
+                }
+                node = &program->nodes[node->right];
             }
-            else if (pid > 0) //THIS IS THE PARENT
+            return mysh_run_node(shell, program, node - program->nodes);
+        case NODE_AND:
+        case NODE_OR:
+            status = mysh_run_node(shell, program, node->left);
+            for(;;)
             {
-                usefulInfo = wait(&status);
-                if (argc)
+                Node * next = &program->nodes[node->right];
+                int chained = next->type == NODE_AND || next->type == NODE_OR;
+                if(shell->quit)
                 {
-                    printf("     Parent waited on pid: %d\n", usefulInfo);
+                    return status;
                 }
-                free(backup);
-
+                if((status == 0) == (node->type == NODE_AND))
+                {
+                    status = mysh_run_node(shell, program,
+                            chained ? next->left : node->right);
+                }
+                if(!chained)
+                {
+                    return status;
+                }
+                node = next;
+            }
+        case NODE_SUBSHELL:
+        {
+            mysh_flush();
+            pid_t pid = fork();
+            if(pid == 0)
+            {
+                status = mysh_run_node(shell, program, node->left);
+                mysh_flush();
+                _exit(status & 0xff);
             }
-            else //THIS IS THE CHILD
+            if(pid < 0)
             {
-                execvp(arguments[0], arguments);
-                fprintf(stderr, "     %s: No such file or directory\n", command);
-                fprintf(stderr, "     command status: %d\n", status);
-                mysh_quit(argc,  argv);
-                free(backup);
-                _exit(EXIT_FAILURE);
-            }//End Fork and Exec Block
-            memset(arguments, 0, sizeof(arguments));
+                mysh_perror("Fork error; something has gone wrong!");
+                return 1;
+            }
+            waitpid(pid, &status, 0);
+            return mysh_status(status);
         }
+    }
+    return 1;
+}//end mysh_run_node
+
+/*mysh_run
+ *
+ * Runs a program built by mysh_compile.
+ *
+ * @return The status of the last command run (0 for an empty program)
+ */
+int mysh_run(Shell * shell, Program * program)
+{
+    if(program->root < 0)
+    {
         return 0;
     }
+    return mysh_run_node(shell, program, program->root);
+}//end mysh_run
 
-}//end mysh_bang
+/*mysh_script
+ *
+ * Runs a script file. The whole file is compiled before anything runs, so
+ * a syntax error anywhere stops the script before its first command.
+ *
+ * @return The status of the last command run
+ * @return 2 If the file cannot be read or does not compile
+ */
+int mysh_script(Shell * shell, const char * path)
+{
+    FILE * file = fopen(path, "r");
+    if(file == NULL)
+    {
+        mysh_perror(path);
+        return 2;
+    }
+    size_t size = 4096;
+    size_t used = 0;
+    size_t bytes;
+    char * text = (char *) malloc(size);
+    while((bytes = fread(text + used, 1, size - used - 1, file)) > 0)
+    {
+        used += bytes;
+        if(used + 1 == size)
+        {
+            size *= 2;
+            text = (char *) realloc(text, size);
+        }
+    }
+    fclose(file);
+    text[used] = '\0';
 
-/*mysh_help
+    Program * program = mysh_compile(text);
+    free(text);
+    if(program == NULL)
+    {
+        return 2;
+    }
+    int status = mysh_run(shell, program);
+    free(program);
+    return status;
+}//end mysh_script
+
+typedef struct serveClient
+{
+    int socket;
+    pid_t pid;              //Running command; 0 while idle
+    int fds[3];             //stdin, stdout, stderr sent with the request
+} Client;
+
+typedef struct serveReply
+{
+    int status;             //Exit status; 128 + N if killed by signal N
+    struct rusage usage;    //Resources used by the command
+} Reply;
+
+#define SERVE_LINE 4096
+
+/*mysh_serve_close_fds
  *
- *The internal help function for mysh. When called it prints text explaining
- *how to use each of the internal commands as well as what each command does
+ * Closes the descriptors that came with a client's last request.
+ */
+static void mysh_serve_close_fds(Client * client)
+{
+    for(int i = 0; i < 3; i++)
+    {
+        if(client->fds[i] >= 0)
+        {
+            close(client->fds[i]);
+        }
+        client->fds[i] = -1;
+    }
+}//end mysh_serve_close_fds
+
+/*mysh_serve_reply
  *
- * @params argc Used to pass in the verbose flag (Not used in this function
- * @params argv Used to pass in the history struct (Not used in this function)
- * @return 0 Signals the success of the help command
+ * Sends the result of a request back to its client and releases the
+ * descriptors that came with it.
  */
-int mysh_help(int argc, char * argv[])
+static void mysh_serve_reply(Client * client, int status,
+        const struct rusage * usage)
 {
-    if(argc)
+    Reply reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.status = status;
+    if(usage != NULL)
     {
-        printf("     COMMAND: help => processing!");
-    }
-    printf("Internal Commands:\n");
-    printf("!N:      Rexecute the Nth command in the history list where N is a \n");
-    printf("         positive integer.\n");
-    printf("help:    Outputs this text.\n");
-    printf("history: Outputs the list of commands entered. Only 'remembers' a \n");
-    printf("         certain number of commands.The value can be set when first \n");
-    printf("         running the shell using the -h flag and specifying a  \n");
-    printf("         positive integer afterwards. The default integer is 10. \n");
-    printf("quit:    Deallocs all memory in use by the shell and then cleanly \n");
-    printf("         terminates the shell.\n");
-    printf("verbose: Toggle verbose mode in the shell. Can be set when the shell \n");
-    printf("         is first run by using the -v flag. Verbose takes 'on' or  \n");
-    printf("         'off' as arguments.\n");
-    return 0;
-}//end mysh_help
+        reply.usage = *usage;
+    }
+    send(client->socket, &reply, sizeof(reply), MSG_NOSIGNAL);
+    mysh_serve_close_fds(client);
+    client->pid = 0;
+}//end mysh_serve_reply
 
-/*mysh_history
+/*mysh_serve_redirect
  *
- * Returns the list of commands that the user entered in to the terminal up
- * to a certain amount (Defined by the user or 10 by default).
+ * Points the server's own stdout and stderr at the client's while an
+ * internal command runs for it.
  *
- * @params argc The verbose flag; used for print extra information to stdout
- * @params argv The history struct; contains the command list and the history
- * value
- * @return 0 Upon success
+ * @params saved Receives the descriptors needed by mysh_serve_restore
  */
-int mysh_history(int argc, char * argv[])
+static void mysh_serve_redirect(Client * client, int * saved)
 {
-    if(argc)
+    mysh_flush();
+    for(int i = 1; i < 3; i++)
+    {
+        saved[i] = -1;
+        if(client->fds[i] >= 0)
+        {
+            saved[i] = dup(i);
+            dup2(client->fds[i], i);
+        }
+    }
+}//end mysh_serve_redirect
+
+/*mysh_serve_restore
+ *
+ * Undoes mysh_serve_redirect.
+ */
+static void mysh_serve_restore(int * saved)
+{
+    mysh_flush();
+    for(int i = 1; i < 3; i++)
+    {
+        if(saved[i] >= 0)
+        {
+            dup2(saved[i], i);
+            close(saved[i]);
+        }
+    }
+}//end mysh_serve_restore
+
+/*mysh_serve_fork
+ *
+ * Runs a program for a client in a forked copy of the shell, wired to the
+ * client's descriptors. The client is answered once the child is reaped.
+ * The child never execs, so close-on-exec does not help it; everything past
+ * stderr (The listener, the signalfd, and every client's socket and passed
+ * descriptors) is closed by hand so that no other client's pipes are held
+ * open by this one's command.
+ *
+ * @return The pid of the child, or -1 if the fork failed
+ */
+static pid_t mysh_serve_fork(Shell * shell, Client * client, Program * program)
+{
+    mysh_flush();
+    pid_t pid = fork();
+    if(pid == 0)
+    {
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+        for(int i = 0; i < 3; i++)
+        {
+            if(client->fds[i] >= 0 && client->fds[i] != i)
+            {
+                dup2(client->fds[i], i);
+            }
+        }
+        if(syscall(SYS_close_range, 3, ~0U, 0) < 0)
+        {
+            for(long fd = 3, limit = sysconf(_SC_OPEN_MAX); fd < limit; fd++)
+            {
+                close(fd);
+            }
+        }
+        int status = mysh_run(shell, program);
+        mysh_flush();
+        _exit(status & 0xff);
+    }
+    return pid;
+}//end mysh_serve_fork
+
+/*mysh_serve_request
+ *
+ * Runs one request. A single internal command (Or assignment) that changes
+ * the warm state runs inside the server, with its output sent to the
+ * client's descriptors, and is answered straight away. help, history, and
+ * a bare export only print, and may print a lot, so like a list or
+ * subshell they run in a forked copy of the shell. A single external
+ * command goes through mysh_spawn. Forked requests are answered once the
+ * child has been reaped. !N replays are followed to the program they name.
+ *
+ * @return 1 If the client asked to quit
+ * @return 0 Otherwise
+ */
+static int mysh_serve_request(Shell * shell, Client * client, const char * line)
+{
+    int saved[3];
+    mysh_serve_redirect(client, saved);
+    Program * program = mysh_compile(line);
+    mysh_serve_restore(saved);
+    mysh_remember(shell->history, line, program);
+    int failed = 2;
+    for(int depth = 0; program != NULL && program->root >= 0 &&
+            program->nodes[program->root].type == NODE_SIMPLE &&
+            program->words[program->nodes[program->root].left][0] == '!'; depth++)
     {
-        printf("     COMMAND: history => processing!");
+        char ** words = program->words + program->nodes[program->root].left;
+        char * end;
+        long distance = strtol(words[0] + 1, &end, 10);
+        program = (end != words[0] + 1 && *end == '\0' && depth < BANG_DEPTH) ?
+                mysh_history_program(shell->history, distance) : NULL;
+        failed = 1;
+    }
+    if(program == NULL)
+    {
+        mysh_serve_reply(client, failed, NULL);
+        return 0;
+    }
+    if(program->root < 0)
+    {
+        mysh_serve_reply(client, 0, NULL);
+        return 0;
     }
-    History * holder = ((History *)argv);
-    int limit = holder->commandHistoryMem;
-    int formater = limit;
-    int commands = holder->commands;
 
-    if(commands < limit)
+    Node * node = &program->nodes[program->root];
+    if(node->type != NODE_SIMPLE)
     {
-        for(int i = 0; i < commands; i++)
-        {
-            printf("%d: %s", i, holder->commandHistory[i]);
-        }
+        client->pid = mysh_serve_fork(shell, client, program);
     }
     else
     {
-        for (int i = 0; i < limit; i++) {
-            printf("%d: %s", commands - formater, holder->commandHistory[i]);
-            formater--;
+        char * arguments[MAX_ARGUMENTS];
+        char * expanded = mysh_arguments(program, node, arguments);
+        if(arguments[0] != NULL && (!strcmp(arguments[0], "help") ||
+                !strcmp(arguments[0], "history") ||
+                (!strcmp(arguments[0], "export") && arguments[1] == NULL)))
+        {
+            //Unbounded output; a slow reader must not stall the server
+            client->pid = mysh_serve_fork(shell, client, program);
+        }
+        else if(arguments[0] == NULL || mysh_is_builtin(arguments[0]) ||
+                mysh_assign(arguments))
+        {
+            int status = 0;
+            if(arguments[0] != NULL && mysh_is_builtin(arguments[0]))
+            {
+                mysh_serve_redirect(client, saved);
+                status = mysh_builtin(shell, arguments);
+                mysh_serve_restore(saved);
+            }
+            free(expanded);
+            mysh_serve_reply(client, status, NULL);
+            if(shell->quit)
+            {
+                shell->quit = 0;
+                return 1;
+            }
+            return 0;
         }
+        else
+        {
+            Glob glob = {0};
+            char ** words = mysh_glob(&glob, arguments);
+            client->pid = mysh_spawn(words, client->fds);
+            mysh_glob_free(&glob);
+        }
+        free(expanded);
+    }
+
+    if(client->pid < 0)
+    {
+        mysh_perror("Fork error; something has gone wrong!");
+        mysh_serve_reply(client, 1, NULL);
+    }
+    else if(shell->verbose)
+    {
+        mysh_out(1, "     Serving pid: %d\n", client->pid);
     }
     return 0;
-}//end mysh_history
+}//end mysh_serve_request
 
-/*mysh_quit
+/*mysh_serve_receive
  *
- * Frees the history struct and all of the command strings within its list.
- * It then signals for the termination of the shell upon it's success.
+ * Reads one request packet from a client: the command line as data and
+ * up to three descriptors (stdin, stdout, stderr) passed with SCM_RIGHTS.
  *
- * @params argc The verbose flag; used to print extra information to stdout
- * @params argv The history struct; contains the command list which must be
- * freed along with the struct itself
- * @return 0 Upon success
+ * @params line Receives the null terminated command line
+ * @return 1 If a request was read
+ * @return 0 If the client hung up (Or sent something unreadable)
  */
-int mysh_quit(int argc, char * argv[])
+static int mysh_serve_receive(Client * client, char * line)
 {
-    if(argc)
+    union
+    {
+        char buffer[CMSG_SPACE(sizeof(int) * 3)];
+        struct cmsghdr align;
+    } control;
+    struct iovec data = {line, SERVE_LINE - 2};
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+
+    ssize_t bytes = recvmsg(client->socket, &message, MSG_CMSG_CLOEXEC);
+    if(bytes <= 0)
     {
-        printf("     COMMAND: quit => processing!\n");
+        return 0;
     }
-
-    for(int i = 0; i < ((History *)argv)->commandHistoryMem; i++)
+    //Keep the first three descriptors; any others (Or all of them, if the
+    //packet was cut short) are closed rather than leaked
+    int truncated = message.msg_flags & (MSG_TRUNC | MSG_CTRUNC);
+    int taken = 0;
+    for(struct cmsghdr * header = CMSG_FIRSTHDR(&message); header != NULL;
+            header = CMSG_NXTHDR(&message, header))
     {
-        free(((History *)argv)->commandHistory[i]);
+        if(header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS)
+        {
+            int count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for(int i = 0; i < count; i++)
+            {
+                int fd;
+                memcpy(&fd, CMSG_DATA(header) + sizeof(int) * i, sizeof(int));
+                if(!truncated && taken < 3)
+                {
+                    client->fds[taken++] = fd;
+                }
+                else
+                {
+                    close(fd);
+                }
+            }
+        }
     }
-    free(((History *)argv)->commandHistory);
-    free((History *)argv);
-    return 0;
-}//end mysh_quit
+    if(truncated)
+    {
+        return 0;
+    }
+    if(bytes > 0 && line[bytes - 1] == '\0')
+    {
+        bytes--;
+    }
+    if(bytes == 0 || line[bytes - 1] != '\n')
+    {
+        line[bytes++] = '\n';
+    }
+    line[bytes] = '\0';
+    return 1;
+}//end mysh_serve_receive
 
-/*verbose
+/*mysh_serve
  *
- * Turns verbose mode on or off. Verbose mode on prints additional
- * information to stdout. Off leaves all of the extra info off.
+ * Runs the shell as a command server on a Unix domain (SOCK_SEQPACKET)
+ * socket so that one warm shell, with its PATH cache, variables, and
+ * history, can serve many local clients at once.
  *
- * @return 1 If user wants vmode on
- * @return 0 If user wants vmode off
- * @return argc Something went wrong (So change nothing!)
+ * Each request is a single packet holding a command line, optionally with
+ * the client's stdin, stdout, and stderr attached as SCM_RIGHTS; the
+ * command reads and writes those descriptors directly. Each request is
+ * answered with a single Reply packet. A client may send its next request
+ * once the previous one has been answered; "quit" is answered with status
+ * 0 and then closes the connection.
+ * SIGINT or SIGTERM stops the server and removes the socket.
+ *
+ * Internal commands that run inside the server (verbose, unset, export with
+ * arguments, assignments) only write short diagnostics, and they write them
+ * with blocking writes. A client must not let its stderr pipe fill up
+ * while waiting for a reply. Everything that can print without bound runs
+ * in a child.
+ *
+ * The socket is created with mode 0600 and connections from other users are
+ * refused. An existing socket at socketPath is replaced; any other kind of
+ * file there is left alone and the server does not start.
+ *
+ * @params shell The shell state shared by every request
+ * @params socketPath Where to create the socket
+ * @return 0 Upon a clean shutdown
+ * @return 1 If the socket could not be set up
  */
-int mysh_verbose(int argc, char * argv[])
+int mysh_serve(Shell * shell, const char * socketPath)
 {
-    if(argc)
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    if(strlen(socketPath) >= sizeof(address.sun_path))
     {
-        printf("     COMMAND: verbose => processing!\n");
+        mysh_out(2, "     serve: socket path is too long\n");
+        return 1;
     }
-    History * holder = (History *)argv;
-    int commands = holder->commands;
-    int limit = holder->commandHistoryMem;
-    char * verb;
-    char * on;
-    if(commands > limit)
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socketPath);
+    struct stat info;
+    if(lstat(socketPath, &info) == 0)
     {
-        verb = (char *) malloc(sizeof(char *) * strlen(
-                holder->commandHistory[limit - 1]) + 1);
-
-        on = (char *) malloc(sizeof(char *) * 4);
-        sscanf(holder->commandHistory[limit-1], "%s %s",verb, on);
+        if(!S_ISSOCK(info.st_mode))
+        {
+            mysh_out(2, "     serve: %s exists and is not a socket\n", socketPath);
+            return 1;
+        }
+        unlink(socketPath);
     }
-    else
+
+    //Only our own user may connect; the peer check in the loop enforces it
+    int listener = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    mode_t mask = umask(077);
+    int bound = listener >= 0 && bind(listener, (struct sockaddr *)&address,
+            sizeof(address)) == 0;
+    umask(mask);
+    if(!bound || listen(listener, SOMAXCONN) < 0)
     {
-        verb = (char *) malloc(sizeof(char *) * strlen(
-                holder->commandHistory[commands-1]) + 1);
+        mysh_perror("serve");
+        if(listener >= 0)
+        {
+            close(listener);
+        }
+        return 1;
+    }
 
-        on = (char *) malloc(sizeof(char *) * 4);
-        sscanf(holder->commandHistory[commands-1], "%s %s",verb, on);
+    sigset_t blocked;
+    sigset_t previous;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGCHLD);
+    sigaddset(&blocked, SIGINT);
+    sigaddset(&blocked, SIGTERM);
+    sigprocmask(SIG_BLOCK, &blocked, &previous);
+    int signals = signalfd(-1, &blocked, SFD_CLOEXEC);
+
+    Client * clients = NULL;
+    struct pollfd * polls = NULL;
+    int clientCount = 0;
+    int clientSize = 0;
+    int running = 1;
+    char * line = (char *) malloc(SERVE_LINE);
+    if(shell->verbose)
+    {
+        mysh_out(1, "     Serving on %s\n", socketPath);
     }
-    if(!strcmp(on, "on"))
+    while(running)
     {
-        free(verb);
-        free(on);
-        return 1;
+        polls = (struct pollfd *) realloc(polls, sizeof(struct pollfd) *
+                (clientCount + 2));
+        polls[0].fd = listener;
+        polls[0].events = POLLIN;
+        polls[1].fd = signals;
+        polls[1].events = POLLIN;
+        for(int i = 0; i < clientCount; i++)
+        {
+            //Busy clients are not read until their command finishes
+            polls[i + 2].fd = clients[i].pid ? -1 : clients[i].socket;
+            polls[i + 2].events = POLLIN;
+        }
+        mysh_flush();
+        if(poll(polls, clientCount + 2, -1) < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            mysh_perror("serve");
+            break;
+        }
+
+        if(polls[1].revents & POLLIN)
+        {
+            struct signalfd_siginfo info;
+            if(read(signals, &info, sizeof(info)) == sizeof(info) &&
+                    info.ssi_signo != SIGCHLD)
+            {
+                running = 0;
+            }
+            pid_t pid;
+            int status;
+            struct rusage usage;
+            while((pid = wait4(-1, &status, WNOHANG, &usage)) > 0)
+            {
+                for(int i = 0; i < clientCount; i++)
+                {
+                    if(clients[i].pid == pid)
+                    {
+                        mysh_serve_reply(&clients[i], mysh_status(status),
+                                &usage);
+                        if(shell->verbose)
+                        {
+                            mysh_out(1, "     Parent waited on pid: %d\n", pid);
+                        }
+                        break;
+                    }
+                }
+            }
+        }
+
+        //Walk backwards so a hang up can swap the last client into its place
+        for(int i = clientCount - 1; i >= 0; i--)
+        {
+            if(!polls[i + 2].revents || clients[i].pid)
+            {
+                continue;
+            }
+            if(!mysh_serve_receive(&clients[i], line) ||
+                    mysh_serve_request(shell, &clients[i], line))
+            {
+                mysh_serve_close_fds(&clients[i]);
+                close(clients[i].socket);
+                clients[i] = clients[--clientCount];
+            }
+        }
+
+        if(polls[0].revents & POLLIN)
+        {
+            int socket = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+            struct ucred peer;
+            socklen_t peerLength = sizeof(peer);
+            if(socket >= 0 && (getsockopt(socket, SOL_SOCKET, SO_PEERCRED,
+                    &peer, &peerLength) < 0 || peer.uid != getuid()))
+            {
+                close(socket);
+                socket = -1;
+            }
+            if(socket >= 0)
+            {
+                if(clientCount == clientSize)
+                {
+                    clientSize = clientSize ? clientSize * 2 : 16;
+                    clients = (Client *) realloc(clients, sizeof(Client) *
+                            clientSize);
+                }
+                clients[clientCount].socket = socket;
+                clients[clientCount].pid = 0;
+                for(int i = 0; i < 3; i++)
+                {
+                    clients[clientCount].fds[i] = -1;
+                }
+                clientCount++;
+            }
+        }
     }
-    else if(!strcmp(on, "off"))
+
+    for(int i = 0; i < clientCount; i++)
     {
-        free(verb);
-        free(on);
-        return 0;
+        mysh_serve_close_fds(&clients[i]);
+        close(clients[i].socket);
     }
-    return argc;
-}//end mysh_verbose
+    free(clients);
+    free(polls);
+    free(line);
+    close(signals);
+    close(listener);
+    unlink(socketPath);
+    sigprocmask(SIG_SETMASK, &previous, NULL);
+    return 0;
+}//end mysh_serve
 
 
 /*main
  *
  * The main loop that checks for user input to determine what to do next.
  * It uses getopt to make sure that the appropriate CL arguments are being fed
- * to the program. Shell will quit if those arguments are invalid. Afterwards
- * user input is taken in via getline (from unistd.h); it handles the reallocation
- * of memory for the input string. That string is then parsed and checked against
- * the internal commands. If the input is an internal command that command is then
- * run by the shell and it then returns to the loop. If the command is an external
- * command the program forks and execs it; returning whatever exec returns in case
- * of error or executing the command upon success.
- *
- * The history size is variable but the following numbers are anathema to the shell:
- * 9, 8, 7, 5, 4, and (Sometimes) 3. Basically most things lower than the default
- * cause problems.
+ * to the program. Shell will quit if those arguments are invalid. With
+ * --serve the shell hands over to mysh_serve, and given a script file it runs
+ * that through mysh_script, instead of reading stdin. Otherwise user input is
+ * taken in via getline (from unistd.h); it handles the reallocation of memory
+ * for the input string. That string is then compiled into a program, stored in
+ * the history next to the line, and run. Internal commands are run by the shell
+ * itself; external commands are forked and exec'd, returning whatever exec
+ * returns in case of error or executing the command upon success.
  *
  * @params argc Number of CL arguments
  * @params argv The CL arguments
@@ -358,7 +2779,14 @@ int main(int argc, char * argv[])
     int verboseFlag = 0;
     int historyFlag = 0;
     char * historyValue = NULL;
+    char * serveSocket = NULL;
     int success;
+    static struct option longOptions[] =
+    {
+        {"serve", required_argument, NULL, 's'},
+        {"output-stats", no_argument, NULL, 'o'},
+        {NULL, 0, NULL, 0}
+    };
     char *incomingCommand = (char *) malloc(sizeof(char *) * ALLOC);
     size_t incomingCommandBytes = ALLOC;
     opterr = 0;
@@ -368,7 +2796,7 @@ int main(int argc, char * argv[])
     commandHistoryMaster->commandHistoryMem = 10;
 
     //Time to get the user's arguments!
-    while((success = getopt(argc, argv, "vh:")) != -1)
+    while((success = getopt_long(argc, argv, "vh:", longOptions, NULL)) != -1)
     {
         switch(success)
         {
@@ -382,19 +2810,36 @@ int main(int argc, char * argv[])
                 sscanf(historyValue,"%d",&temporaryInt);
                 if(temporaryInt <= 0)
                 {
-                    fprintf(stderr, "usage: mysh [-v] [-h pos_num]\n");
+                    mysh_out(2, "usage: mysh [-v] [-h pos_num] [--output-stats] "
+                            "[--serve socket | script]\n");
+                    mysh_output_free();
                     return 1;
                 }
                 break;
+            case 's':
+                serveSocket = optarg;
+                break;
+            case 'o':
+                outputStats.enabled = 1;
+                break;
             case '?':
-                if(isprint (optopt))
+                if(optopt == 0 || optopt == 's')
                 {
-                    fprintf(stderr, "Unknown option '-%c'.\n", optopt);
+                    mysh_out(2, "usage: mysh [-v] [-h pos_num] [--output-stats] "
+                            "[--serve socket | script]\n");
+                    mysh_output_free();
+                    return 1;
+                }
+                else if(isprint (optopt))
+                {
+                    mysh_out(2, "Unknown option '-%c'.\n", optopt);
+                    mysh_output_free();
                     return 1;
                 }
                 else
                 {
-                    fprintf(stderr, "Uknown option character '\\x%x'.\n", optopt);
+                    mysh_out(2, "Uknown option character '\\x%x'.\n", optopt);
+                    mysh_output_free();
                     return 1;
                 }
             default:
@@ -409,302 +2854,67 @@ int main(int argc, char * argv[])
         commandHistoryMaster->commandHistoryMem = temporaryInt;
     }
 
-    commandHistoryMaster->commandHistory = (char **) malloc(sizeof(char **) *
-            commandHistoryMaster->commandHistoryMem);
+    commandHistoryMaster->commandHistory = (char **) calloc(
+            commandHistoryMaster->commandHistoryMem, sizeof(char *));
+    commandHistoryMaster->commandPrograms = (Program **) calloc(
+            commandHistoryMaster->commandHistoryMem, sizeof(Program *));
+    mysh_variables_init(environ);
+
+    Shell shell;
+    memset(&shell, 0, sizeof(shell));
+    shell.history = commandHistoryMaster;
+    shell.verbose = verboseFlag;
 
-    printf("mysh[%d]>",commandHistoryMaster->commands);
+    if(serveSocket != NULL || optind < argc)
+    {
+        success = serveSocket != NULL ? mysh_serve(&shell, serveSocket) :
+                mysh_script(&shell, argv[optind]);
+        mysh_quit(shell.verbose, (char **)commandHistoryMaster);
+        free(incomingCommand);
+        mysh_output_free();
+        return success;
+    }
+
+    mysh_out(1, "mysh[%d]>",commandHistoryMaster->commands);
+    mysh_flush();
 
     //Time to run commands!
     while((getline(&incomingCommand, &incomingCommandBytes, stdin)) != EOF)
     {
-        char * command = (char *) malloc(sizeof(char*) * 7);
-        sscanf(incomingCommand,"%s ",command);
-
         if(incomingCommand[0] == '\n' || (int)incomingCommand[0] == 32)
         {
-            printf("mysh[%d]>",commandHistoryMaster->commands);
+            mysh_out(1, "mysh[%d]>",commandHistoryMaster->commands);
+            mysh_flush();
             continue;
         }
 
         //Verbose Check
-        if(verboseFlag)
-        {
-            printf("     Command Entered (Verbatim): %s", incomingCommand);
-            printf("     Command (Arguments Stripped): %s\n", command);
-        }
-
-        if(command[0] == '!') //BANG COMMAND
-        {
-            if(commandHistoryMaster->commandHistoryMem <= commandHistoryMaster->commands)
-            {
-                for(int i = 0; i < commandHistoryMaster->commandHistoryMem; i++)
-                {
-                    commandHistoryMaster->commandHistory[i] =
-                            commandHistoryMaster->commandHistory[i+1];
-                    if(i == commandHistoryMaster->commandHistoryMem - 1)
-                    {
-                        break;
-                    }
-                }
-                free(commandHistoryMaster->commandHistory[
-                        commandHistoryMaster->commandHistoryMem-1]);
-
-                commandHistoryMaster->commandHistory
-                [commandHistoryMaster->commandHistoryMem-1] = (char *)
-                        malloc(sizeof(char *) * (strlen(incomingCommand) + 1));
-
-                strcpy(commandHistoryMaster->commandHistory
-                        [commandHistoryMaster->commandHistoryMem-1],
-                        incomingCommand);
-
-                commandHistoryMaster->commands++;
-                mysh_bang(verboseFlag, (char **)commandHistoryMaster);
-            }
-            else
-            {
-                commandHistoryMaster->commandHistory[commandHistoryMaster->commands] =
-                        (char *) malloc(sizeof(char *) * strlen(incomingCommand) + 1);
-                strcpy(commandHistoryMaster->commandHistory[
-                        commandHistoryMaster->commands],incomingCommand);
-
-                commandHistoryMaster->commands++;
-
-                mysh_bang(verboseFlag,((char **)commandHistoryMaster));
-            }
-        }
-
-        else if(!strcmp(command,"help")) //HELP COMMAND
-        {
-            if(commandHistoryMaster->commandHistoryMem <= commandHistoryMaster->commands)
-            {
-                for(int i = 0; i < commandHistoryMaster->commandHistoryMem; i++)
-                {
-                    commandHistoryMaster->commandHistory[i] =
-                            commandHistoryMaster->commandHistory[i+1];
-
-                    if(i == commandHistoryMaster->commandHistoryMem - 1)
-                    {
-                        break;
-                    }
-                }
-                free(commandHistoryMaster->commandHistory
-                [commandHistoryMaster->commandHistoryMem-1]);
-
-                commandHistoryMaster->commandHistory
-                [commandHistoryMaster->commandHistoryMem-1] = (char *)
-                        malloc(sizeof(char *) * (strlen(incomingCommand) + 1));
-
-                strcpy(commandHistoryMaster->commandHistory
-                        [commandHistoryMaster->commandHistoryMem-1],
-                        incomingCommand);
-
-                commandHistoryMaster->commands++;
-                mysh_help(verboseFlag, NULL);
-            }
-            else
-            {
-                commandHistoryMaster->commandHistory
-                [commandHistoryMaster->commands] =
-                        (char *) malloc(sizeof(char *) * strlen(incomingCommand) + 1);
-
-                strcpy(commandHistoryMaster->commandHistory
-                [commandHistoryMaster->commands], incomingCommand);
-
-                commandHistoryMaster->commands++;
-
-                mysh_help(verboseFlag, NULL);
-            }
-        }
-
-        else if(!strcmp(command,"history")) //HISTORY COMMAND
-        {
-            if(commandHistoryMaster->commandHistoryMem <= commandHistoryMaster->commands)
-            {
-                for(int i = 0; i < commandHistoryMaster->commandHistoryMem; i++)
-                {
-                    commandHistoryMaster->commandHistory[i] =
-                            commandHistoryMaster->commandHistory[i+1];
-
-                    if(i == commandHistoryMaster->commandHistoryMem - 1)
-                    {
-                        break;
-                    }
-                }
-                free(commandHistoryMaster->commandHistory
-                [commandHistoryMaster->commandHistoryMem-1]);
-
-                commandHistoryMaster->commandHistory
-                [commandHistoryMaster->commandHistoryMem-1] = (char *)
-                        malloc(sizeof(char *) * (strlen(incomingCommand) + 1));
-
-                strcpy(commandHistoryMaster->commandHistory
-                        [commandHistoryMaster->commandHistoryMem-1],
-                        incomingCommand);
-
-                commandHistoryMaster->commands++;
-                mysh_history(verboseFlag, (char **)commandHistoryMaster);
-            }
-            else
-            {
-                commandHistoryMaster->commandHistory
-                [commandHistoryMaster->commands] =
-                        (char *) malloc(sizeof(char *) * strlen(incomingCommand) + 1);
-
-                strcpy(commandHistoryMaster->commandHistory
-                [commandHistoryMaster->commands],incomingCommand);
-                commandHistoryMaster->commands++;
-
-                mysh_history(verboseFlag,((char **)commandHistoryMaster));
-            }
-
-
-        }
-
-        else if(!strcmp(command,"quit")) //QUIT COMMAND
+        if(shell.verbose)
         {
-            int quit = mysh_quit(verboseFlag, (char **)commandHistoryMaster);
-            if(!quit)
-            {
-                free(incomingCommand);
-                free(command);
-                return 0;
-            }
+            char * command = (char *) malloc(strlen(incomingCommand) + 1);
+            sscanf(incomingCommand,"%s ",command);
+            mysh_out(1, "     Command Entered (Verbatim): %s", incomingCommand);
+            mysh_out(1, "     Command (Arguments Stripped): %s\n", command);
+            free(command);
         }
 
-        else if(!strcmp(command,"verbose")) //VERBOSE COMMAND
+        //Compiled once; !N replays the stored program
+        Program * program = mysh_compile(incomingCommand);
+        mysh_remember(commandHistoryMaster, incomingCommand, program);
+        if(program != NULL)
         {
-            if(commandHistoryMaster->commandHistoryMem <= commandHistoryMaster->commands)
-            {
-                for(int i = 0; i < commandHistoryMaster->commandHistoryMem; i++)
-                {
-                    commandHistoryMaster->commandHistory[i] =
-                            commandHistoryMaster->commandHistory[i+1];
-
-                    if(i == commandHistoryMaster->commandHistoryMem - 1)
-                    {
-                        break;
-                    }
-                }
-                free(commandHistoryMaster->commandHistory
-                [commandHistoryMaster->commandHistoryMem-1]);
-
-                commandHistoryMaster->commandHistory
-                [commandHistoryMaster->commandHistoryMem-1] = (char *)
-                        malloc(sizeof(char *) * (strlen(incomingCommand) + 1));
-
-                strcpy(commandHistoryMaster->commandHistory
-                        [commandHistoryMaster->commandHistoryMem-1],
-                        incomingCommand);
-
-                commandHistoryMaster->commands++;
-
-                verboseFlag = mysh_verbose(verboseFlag, (char **)commandHistoryMaster);
-            }
-            else
-            {
-                commandHistoryMaster->commandHistory[commandHistoryMaster->commands] =
-                        (char *) malloc(sizeof(char *) * strlen(incomingCommand) + 1);
-
-                strcpy(commandHistoryMaster->commandHistory
-                [commandHistoryMaster->commands],incomingCommand);
-                commandHistoryMaster->commands++;
-
-                verboseFlag = mysh_verbose(verboseFlag,((char **)commandHistoryMaster));
-            }
+            mysh_run(&shell, program);
         }
-
-        else //MOST GLORIOUS EXTERNAL COMMANDS GO HERE
+        if(shell.quit)
         {
-            if(commandHistoryMaster->commandHistoryMem <= commandHistoryMaster->commands)
-            {
-                for(int i = 0; i < commandHistoryMaster->commandHistoryMem; i++)
-                {
-                    commandHistoryMaster->commandHistory[i] =
-                            commandHistoryMaster->commandHistory[i+1];
-
-                    if(i == commandHistoryMaster->commandHistoryMem - 1)
-                    {
-                        break;
-                    }
-                }
-                free(commandHistoryMaster->commandHistory
-                [commandHistoryMaster->commandHistoryMem-1]);
-
-                commandHistoryMaster->commandHistory
-                [commandHistoryMaster->commandHistoryMem-1] = (char *)
-                        malloc(sizeof(char *) * (strlen(incomingCommand) + 1));
-
-                strcpy(commandHistoryMaster->commandHistory
-                        [commandHistoryMaster->commandHistoryMem-1],
-                        incomingCommand);
-
-                commandHistoryMaster->commands++;
-            }
-            else
-            {
-                commandHistoryMaster->commandHistory[commandHistoryMaster->commands] =
-                        (char *) malloc(sizeof(char *) * strlen(incomingCommand) + 1);
-
-                strcpy(commandHistoryMaster->commandHistory
-                [commandHistoryMaster->commands],incomingCommand);
-
-                commandHistoryMaster->commands++;
-            }
-
-            char * arguments[1024];
-            char ** nextCommand = arguments;
-            char * temp = strtok(incomingCommand ," \n");
-            while (temp != NULL)
-            {
-                *nextCommand++ = temp;
-                temp = strtok(NULL, " \n");
-            }
-
-            pid_t pid;
-            pid_t usefulInfo = 0;
-            int status = 0;
-            if (verboseFlag)
-            {
-                int counter = 0;
-                printf("     Input command tokens:\n");
-                for (nextCommand = arguments; *nextCommand != 0; nextCommand++)
-                {
-                    printf("%d:", counter);
-                    puts(*nextCommand);
-                    counter++;
-                }
-            }
-
-            //Begin Fork and Exec Block
-            if ((pid = fork()) < 0)
-            {
-                perror("Fork error; something has gone wrong!");
-            }
-            else if (pid > 0) //THIS IS THE PARENT
-            {
-                usefulInfo = wait(&status);
-                if (verboseFlag) {
-                    printf("     Parent waited on pid: %d\n", usefulInfo);
-                }
-
-            }
-            else //THIS IS THE CHILD
-            {
-                execvp(arguments[0], arguments);
-                fprintf(stderr, "     %s: No such file or directory\n", command);
-                fprintf(stderr, "     command status: %d\n", status);
-                mysh_quit(verboseFlag, (char **) commandHistoryMaster);
-                free(incomingCommand);
-                free(command);
-                _exit(EXIT_FAILURE);
-            }//End Fork and Exec Block
-            memset(arguments, 0, sizeof(arguments));
+            break;
         }
-        free(command);
-        printf("mysh[%d]>",commandHistoryMaster->commands);
+        mysh_out(1, "mysh[%d]>",commandHistoryMaster->commands);
+        mysh_flush();
     }
-    mysh_quit(verboseFlag, (char **)commandHistoryMaster);
+    mysh_quit(shell.verbose, (char **)commandHistoryMaster);
     free(incomingCommand);
+    mysh_output_free();
     return 0;
 }//end main
 